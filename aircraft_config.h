@@ -0,0 +1,105 @@
+/*
+   機体の設定 (舵面ごとのサーボID・操縦桿のピン・電圧値範囲・反転・舵角の既定値)
+   すべてコンパイル時の定数で、矛盾した設定はビルドエラーになる
+   操舵処理(servo_control_all())はこの表からサーボごとに展開され、ピンやIDは定数として埋め込まれる
+   実行時に変わるのは EEPROM に保存する舵角(最小・ニュートラル・最大)だけ
+*/
+
+#ifndef AIRCRAFT_CONFIG_H
+#define AIRCRAFT_CONFIG_H
+
+#include "packet_schema.h"
+
+// 操縦桿 (CONTROL_STICK に指定する)
+#define STICK_MAIN  0 // 本番操縦桿
+#define STICK_SPARE 1 // 予備操縦桿
+#define STICK_VARIANTS 2
+
+#ifndef CONTROL_STICK
+#define CONTROL_STICK STICK_MAIN
+#endif
+
+// 各サーボのID
+#define RUD_ID 1
+#define ELE_ID 2
+
+#define ANALOG_MAX 1023  // analogRead() の最大値
+#define ANGLE_LIMIT 1500 // 舵角の範囲(±0.1°)
+
+// 操縦桿電圧値範囲
+// l_min ~ c_min: 舵角 MIN 側 (reverse なら MAX 側)
+// c_min ~ c_max: ニュートラル
+// c_max ~ h_max: 舵角 MAX 側 (reverse なら MIN 側)
+typedef struct StickBand {
+  int16_t l_min;
+  int16_t c_min;
+  int16_t c_max;
+  int16_t h_max;
+} StickBand;
+
+typedef struct SurfaceConfig {
+  uint8_t id;
+  uint8_t pin;                      // 操縦桿アナログ信号ピン
+  const char *alias;                // 表示名 (フラッシュ上の文字列)
+  StickBand band[STICK_VARIANTS];   // 操縦桿ごとの電圧値範囲
+  bool reverse;                     // 操縦桿の読みを反転させる
+  int16_t angle[3];                 // 舵角の既定値 MIN, NEU, MAX (0.1°) EEPROM が空か壊れているときに使う
+} SurfaceConfig;
+
+const char rudder_alias[] PROGMEM = "RUDDER  ";
+const char elevator_alias[] PROGMEM = "ELEVATOR";
+
+// サーボ INDEX の順 (ESP とのやり取り(CMD_SET, DCM_DSP)はサーボIDで舵面を指すので、並びは問わない)
+constexpr SurfaceConfig aircraft[] = {
+  // ラダー     l_min ~ c_min: ラダー右, c_max ~ h_max: ラダー左
+  {RUD_ID, A0, rudder_alias,   {{0, 550, 570, ANALOG_MAX}, {0, 520, 535, ANALOG_MAX}}, false, { -500, 0, 500}},
+  // エレベータ l_min ~ c_min: エレベータ下, c_max ~ h_max: エレベータ上
+  {ELE_ID, A1, elevator_alias, {{0, 520, 540, ANALOG_MAX}, {0, 520, 532, ANALOG_MAX}}, true,  { -500, 0, 500}},
+};
+
+#define AIRCRAFT_SURFACES (sizeof(aircraft) / sizeof(aircraft[0]))
+
+// ---------- 設定の検査 ----------------------------------------------------------------------- //
+
+constexpr bool stick_band_valid(const StickBand &b) {
+  return 0 <= b.l_min && b.l_min < b.c_min && b.c_min <= b.c_max && b.c_max < b.h_max && b.h_max <= ANALOG_MAX;
+}
+
+constexpr bool surface_angles_valid(const SurfaceConfig &s) {
+  return -ANGLE_LIMIT <= s.angle[0] && s.angle[0] < s.angle[1] && s.angle[1] < s.angle[2] && s.angle[2] <= ANGLE_LIMIT;
+}
+
+// 計測基板パケットのスロットはサーボID - 1
+constexpr bool surface_id_valid(const SurfaceConfig &s) {
+  return 1 <= s.id && s.id <= SENSORY_SLOT_COUNT;
+}
+
+// i 番目より後に i 番目と同じID・ピンの舵面が無い
+constexpr bool surface_unique_from(unsigned i, unsigned j) {
+  return j >= AIRCRAFT_SURFACES || (aircraft[i].id != aircraft[j].id && aircraft[i].pin != aircraft[j].pin && surface_unique_from(i, j + 1));
+}
+
+constexpr bool surfaces_unique(unsigned i = 0) {
+  return i >= AIRCRAFT_SURFACES || (surface_unique_from(i, i + 1) && surfaces_unique(i + 1));
+}
+
+// サーボID id の舵面の INDEX (無ければ 0xFF)
+constexpr uint8_t surface_index(uint8_t id, unsigned i = 0) {
+  return i >= AIRCRAFT_SURFACES ? 0xFF : aircraft[i].id == id ? i : surface_index(id, i + 1);
+}
+
+static_assert(CONTROL_STICK < STICK_VARIANTS, "CONTROL_STICK must be STICK_MAIN or STICK_SPARE");
+static_assert(AIRCRAFT_SURFACES >= 1 && AIRCRAFT_SURFACES <= SENSORY_SLOT_COUNT, "aircraft must have 1 to SENSORY_SLOT_COUNT surfaces");
+static_assert(surfaces_unique(), "aircraft surfaces must have distinct servo IDs and stick pins");
+
+// 舵面ごとの検査 (サーボ INDEX I の処理を展開するときに確かめる)
+template <uint8_t I> struct SurfaceCheck {
+  static_assert(I < AIRCRAFT_SURFACES, "surface index out of range");
+  static_assert(surface_id_valid(aircraft[I]), "servo ID must select a sensory slot (1 to SENSORY_SLOT_COUNT)");
+  static_assert(stick_band_valid(aircraft[I].band[STICK_MAIN]), "main stick band must satisfy 0 <= l_min < c_min <= c_max < h_max <= 1023");
+  static_assert(stick_band_valid(aircraft[I].band[STICK_SPARE]), "spare stick band must satisfy 0 <= l_min < c_min <= c_max < h_max <= 1023");
+  static_assert(surface_angles_valid(aircraft[I]), "default angles must satisfy -1500 <= MIN < NEU < MAX <= 1500");
+  static const bool ok = true;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*
+   パケット組み立て・解析処理の実行時間計測
+   CODEC_BENCH を定義してビルドすると setup() で一度だけ実行し、
+   各処理の1回あたりのCPUサイクル数を DEBUG_SERIAL に出力する
+   (例: WASA-Control.ino の先頭に #define CODEC_BENCH を追加する)
+   最適化の前後でこの値を比較する
+*/
+
+#ifdef CODEC_BENCH
+
+#define CODEC_BENCH_LOOPS 1000
+
+volatile uint8_t codec_bench_sink = 0; // 最適化で計測対象が消えないようにするための書き込み先
+
+void codec_bench_print(const __FlashStringHelper *name, uint32_t elapsed) {
+  DEBUG_SERIAL.print(name);
+  DEBUG_SERIAL.print(F("\t"));
+  DEBUG_SERIAL.print(elapsed * (F_CPU / 1000000UL) / CODEC_BENCH_LOOPS);
+  DEBUG_SERIAL.println(F(" cycles"));
+}
+
+// expr を CODEC_BENCH_LOOPS 回実行した平均サイクル数を出力する (micros() の分解能は4us)
+#define CODEC_BENCH_RUN(name, expr) { \
+    uint32_t begin_time = micros(); \
+    for (uint16_t n = 0; n < CODEC_BENCH_LOOPS; n++) codec_bench_sink ^= (uint8_t)(expr); \
+    codec_bench_print(F(name), micros() - begin_time); \
+  }
+
+// servo_info[0] が登録済みであること
+// 解析処理の計測で servo_info[0] の計測値は0になるが、次のリターンパケットで上書きされる
+void codec_bench() {
+  DEBUG_SERIAL.println(F("---- CODEC BENCH ----"));
+  CODEC_BENCH_RUN("checksum(32)",       checksum(servo_rx_packet, 32));
+  CODEC_BENCH_RUN("servo_build_move",   servo_build_move((uint8_t)n, n, 20));
+  CODEC_BENCH_RUN("servo_build_request", servo_build_request((uint8_t)n));
+  CODEC_BENCH_RUN("servo_build_torque_mode", servo_build_torque_mode((uint8_t)n, 1));
+  CODEC_BENCH_RUN("servo_build_reboot", servo_build_reboot((uint8_t)n));
+
+  memset(servo_rx_packet, 0, sizeof(servo_rx_packet));
+  servo_rx_packet[0] = SERVO_RX_HEADER_0;
+  servo_rx_packet[1] = SERVO_RX_HEADER_1;
+  servo_rx_packet[SERVO_INFO_REPLY_LEN - 1] = checksum(servo_rx_packet, SERVO_INFO_REPLY_LEN - 1);
+  CODEC_BENCH_RUN("servo_check_packet", servo_check_packet(SERVO_INFO_LEN));
+  CODEC_BENCH_RUN("servo_decode_info",  (servo_decode_info(0, sensory_packet(servo_info[0].id)), 0));
+
+  CODEC_BENCH_RUN("sensory_build",      sensory_build());
+  CODEC_BENCH_RUN("command_build_all",  command_build_all());
+
+  esp_rx_packet[0] = ESP_RX_HEADER_0;
+  esp_rx_packet[1] = ESP_RX_HEADER_1;
+  esp_rx_packet[ESP_PKT_DEVICE] = 0x00;
+  esp_rx_packet[ESP_PKT_COMMAND] = CMD_REQ;
+  esp_rx_packet[ESP_PKT_LENGTH] = 1;
+  esp_rx_packet[ESP_PKT_DATA] = REQ_INI;
+  command_len = esp_packet_len(1);
+  esp_rx_packet[command_len - 1] = checksum(esp_rx_packet, command_len - 1);
+  CODEC_BENCH_RUN("command_check_packet", command_check_packet());
+
+  // 試験モードでないサーボへの CMD_TMV (コマンド表を引いて検査で拒否されるまで 何も送信しない)
+  command_id = CMD_TMV;
+  command_data_len = 3;
+  esp_rx_packet[ESP_PKT_DATA] = servo_info[0].id;
+  esp_rx_packet[ESP_PKT_DATA + 1] = lowByte(300);
+  esp_rx_packet[ESP_PKT_DATA + 2] = highByte(300);
+  CODEC_BENCH_RUN("command_interpret", (command_interpret(), 0));
+  command_len = 0;
+  DEBUG_SERIAL.println(F("---------------------"));
+}
+
+#endif
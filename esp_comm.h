@@ -1,36 +1,18 @@
 #include "futaba_servo.h"
+#include "servo_health.h"
 
-#define CMD_LOG 0x00
-#define CMD_SET 0x01
-#define CMD_REQ 0x02
-#define CMD_RBT 0x03
-#define CMD_TQS 0x04
-#define CMD_TMS 0x05
-#define CMD_TMD 0x06
-#define CMD_TMV 0x07
-#define CMD_SWP 0x08
-#define CMD_PRP 0xF0
-
-#define SET_RUD_MIN B00000001
-#define SET_RUD_NEU B00000010
-#define SET_RUD_MAX B00000011
-#define SET_ELE_MIN B00000101
-#define SET_ELE_NEU B00000110
-#define SET_ELE_MAX B00000111
-
-#define REQ_INI 0x01
-
-#define DCM_DSP 0x00
-#define DCM_PRP 0x01
+// コマンド番号(CMD_*, SET_*, REQ_*, DCM_*)とパケット構造は packet_schema.h で定義
 
 #define ESP_SERIAL Serial1
 #define ESP_BAUDRATE 9600
 
-#define ESP_PACKET_SIZE 128
+#define ESP_PACKET_SIZE 128                      // 受信パケット最大長 (CMD_LOG の文字列は最大122文字 ESP 側はこの長さで送る)
+#define ESP_TX_PACKET_SIZE esp_packet_len(DSP_DATA_LEN) // 送信パケット最大長 (初期値送信)
 uint8_t esp_rx_packet[ESP_PACKET_SIZE] = {0};
-uint8_t esp_tx_packet[ESP_PACKET_SIZE] = {0};
+uint8_t esp_tx_packet[ESP_TX_PACKET_SIZE] = {0};
 
 #define ESP_CONFIRM_COOLDOWN 5000UL
+#define COMMAND_BURST_MAX 4 // 1回の command_handle() で処理するコマンドの最大数 (返信を送ったらそこで止める)
 
 uint8_t command_len = 0;
 uint8_t command_data_len = 0;
@@ -38,39 +20,77 @@ uint8_t command_data_len = 0;
 uint8_t command_device = 0;
 uint8_t command_id = 0;
 
+bool command_replied = false; // この command_handle() で返信を送った
+
 bool confirm_wait = false;
 uint32_t confirm_wait_time = 0;
 uint8_t confirm_device = 0;
 uint8_t confirm_command_id = 0xFF;
 uint16_t confirm_param[3] = {0};
 
+// esp_tx_packet に組み立て済みのパケットを送信する
+void command_transmit(uint8_t len) {
+  link_write(ESP_SERIAL, LINK_ESP, esp_tx_packet, len);                       // 送信
+  link_flush(ESP_SERIAL, LINK_ESP);                               // 送信完了待ち
+  command_replied = true;
+}
+
 void command_setup() {
-  ESP_SERIAL.begin(ESP_BAUDRATE);
+  link_begin(ESP_SERIAL, LINK_ESP, ESP_BAUDRATE);
+}
+
+// esp_rx_packet に受信済みのコマンドのヘッダーとチェックサムを確認する
+bool command_check_packet() {
+  return esp_rx_packet[0] == ESP_RX_HEADER_0 && esp_rx_packet[1] == ESP_RX_HEADER_1 && esp_rx_packet[command_len - 1] == checksum(esp_rx_packet, command_len - 1);
 }
 
 bool command_receive() {
-  if (ESP_SERIAL.available()) {
+  if (link_available(ESP_SERIAL, LINK_ESP)) {
     uint32_t wait_time;   // リターンパケット待ち用引数
-    // リターンパケットの最初のバイトが0x8Fになるまで待つ(最大10ms) // パケットズレ防止
-    // リターンパケットが来ても、以前受信に失敗した分かも知れないのでヘッダーが来るまで流す
+    // ヘッダー(0x8F 0xF8)が2バイト揃うまで待つ(最大10ms) // パケットズレ防止
+    // 以前受信に失敗した分や途中で切れたパケットの 0x8F かも知れないので、続く 0xF8 まで確かめてから読み始める
     wait_time = millis();
-    while ((esp_rx_packet[0] = ESP_SERIAL.read()) != 0x8F) if ((uint32_t)(millis() - wait_time) > 10UL) return false;
+    int prev = -1;
+    while (true) {
+      int c = link_read(ESP_SERIAL, LINK_ESP);
+      if (c >= 0) {
+        if (prev == ESP_RX_HEADER_0 && c == ESP_RX_HEADER_1) break;
+        if (prev >= 0) link_discard(LINK_ESP);
+        prev = c;
+      }
+      if ((uint32_t)(millis() - wait_time) > 10UL) {
+        if (prev >= 0) link_discard(LINK_ESP);
+        link_timeout(LINK_ESP);
+        return false;
+      }
+    }
+    esp_rx_packet[0] = ESP_RX_HEADER_0;
+    esp_rx_packet[1] = ESP_RX_HEADER_1;
     // 残りのバイトを読み取る
     wait_time = millis();
-    for (uint8_t j = 1; j < 5; j++) {
-      while (!ESP_SERIAL.available()) if ((uint32_t)(millis() - wait_time) > 3UL) return false;
-      esp_rx_packet[j] = ESP_SERIAL.read();
+    for (uint8_t j = 2; j < ESP_PKT_DATA; j++) {
+      while (!link_available(ESP_SERIAL, LINK_ESP)) if ((uint32_t)(millis() - wait_time) > 3UL) {
+          link_timeout(LINK_ESP);
+          return false;
+        }
+      esp_rx_packet[j] = link_read(ESP_SERIAL, LINK_ESP);
       wait_time = millis();
     }
-    command_id = esp_rx_packet[3];
-    command_device = esp_rx_packet[2];
-    command_data_len = esp_rx_packet[4];
-    command_len = command_data_len + 6;
-    if (command_len > ESP_PACKET_SIZE) return false;
+    command_id = esp_rx_packet[ESP_PKT_COMMAND];
+    command_device = esp_rx_packet[ESP_PKT_DEVICE];
+    command_data_len = esp_rx_packet[ESP_PKT_LENGTH];
+    if (command_data_len > ESP_PACKET_SIZE - esp_packet_len(0)) {
+      link_frame(LINK_ESP, false);
+      return false;
+    }
+    command_len = esp_packet_len(command_data_len);
     wait_time = millis();
-    for (uint8_t j = 5; j < command_len; j++) {
-      while (!ESP_SERIAL.available()) if ((uint32_t)(millis() - wait_time) > 4UL) return false;
-      esp_rx_packet[j] = ESP_SERIAL.read();
+    for (uint8_t j = ESP_PKT_DATA; j < command_len; j++) {
+      while (!link_available(ESP_SERIAL, LINK_ESP)) if ((uint32_t)(millis() - wait_time) > 4UL) {
+          link_timeout(LINK_ESP);
+          return false;
+        }
+      esp_rx_packet[j] = link_read(ESP_SERIAL, LINK_ESP);
       wait_time = millis();
     }
     /*DEBUG_SERIAL.println("ESP RECEIVED:");
@@ -80,73 +100,56 @@ bool command_receive() {
       }
       DEBUG_SERIAL.print(" actual checksum is " + String(checksum(esp_rx_packet, command_len - 1), HEX));
       DEBUG_SERIAL.println();*/
-    if (esp_rx_packet[0] == 0x8F && esp_rx_packet[1] == 0xF8 && esp_rx_packet[command_len - 1] == checksum(esp_rx_packet, command_len - 1)) return true;
+    bool ok = command_check_packet();
+    link_frame(LINK_ESP, ok);
+    return ok;
   }
   return false;
 }
 
-void command_log();
-void command_confirm_set();
-void command_respond();
-void command_confirm_reboot();
-void command_confirm_torque_percentage_set();
-void command_confirm_torque_mode_set();
-void command_confirm_test_mode_set();
-void command_test_move();
-void command_confirm_sweep();
-
-void command_confirm();
 void command_send_all();
+void command_send_health();
+void command_send_links();
+void command_send_bus();
+
+// ---------- コマンド処理 --------------------------------------------------------------------- //
+// コマンドは command_table (CMD_* の番号順) の1行で定義する
+// 確認が必要なコマンドは、check() で検証して実行に使う値を param に取っておき、confirm() で確認パケット(DCM_PRP)を返す
+// ESP から CMD_PRP で承認されたら apply() で実行する 確認が不要なコマンド(confirm が NULL)はすぐに apply() する
+// 確認パケットの組み立てと確認待ちの管理は command_interpret() と command_confirm() で共通
+
+// データ長が min_len〜max_len でないパケットは、古い受信データを読まないよう検証の前に捨てる
+typedef struct CommandEntry {
+  uint8_t min_len;                                           // 最小データ長
+  uint8_t max_len;                                           // 最大データ長
+  bool (*check)(uint16_t *param);                            // 受信データを検証し、実行に使う値を param[0〜2] に入れる (NULL: 検証なし)
+  uint8_t (*confirm)(uint8_t *data, const uint16_t *param);  // 確認パケットのデータ部(コマンド番号の後)を書き込み、長さを返す (NULL: 確認なし)
+  void (*apply)(const uint16_t *param);                      // 実行
+} CommandEntry;
+
+// 受信データ先頭のサーボIDのINDEX (登録されていなければ 0xFF)
+uint8_t command_servo_index() {
+  return get_index(esp_rx_packet[ESP_PKT_DATA]);
+}
 
-void command_interpret() {
-  // DEBUG_SERIAL.println("Command ID is " + String(command_id));
-  switch (command_id) {
-    case CMD_LOG:
-      command_log();
-      break;
-    case CMD_SET:
-      command_confirm_set();
-      break;
-    case CMD_REQ:
-      command_respond();
-      break;
-    case CMD_RBT:
-      command_confirm_reboot();
-      break;
-    case CMD_TQS:
-      command_confirm_torque_percentage_set();
-      break;
-    case CMD_TMS:
-      command_confirm_torque_mode_set();
-      break;
-    case CMD_TMD:
-      command_confirm_test_mode_set();
-      break;
-    case CMD_TMV:
-      command_test_move();
-      break;
-    case CMD_SWP:
-      command_confirm_sweep();
-      break;
-    case CMD_PRP:
-      command_confirm();
-      command_send_all();
-      break;
-  }
+// 受信データ data[offset], data[offset + 1] の int16
+int16_t command_data_int16(uint8_t offset) {
+  return (int16_t)PacketField<uint16_t, 0>::get(esp_rx_packet + ESP_PKT_DATA + offset);
 }
 
-void command_handle() {
-  if (confirm_wait && millis() - confirm_wait_time > ESP_CONFIRM_COOLDOWN) confirm_wait = false;
-  if (command_receive()) {
-    command_interpret();
-  }
+// 変更前・変更後の値 (トルク%, トルクモード, テストモード) の確認パケット
+uint8_t command_confirm_change(uint8_t *data, uint8_t old_value, const uint16_t *param) {
+  data[0] = servo_info[(uint8_t)param[0]].id;                                   // データ：対象のサーボID
+  data[1] = old_value;                                                          // データ：変更前の値
+  data[2] = (uint8_t)param[1];                                                  // データ：変更後の値
+  return 3;
 }
 
-void command_log() {
+void command_apply_log(const uint16_t *) {
   DEBUG_SERIAL.print(F("[DEVICE_ID: "));
-  DEBUG_SERIAL.print(esp_rx_packet[2]);
+  DEBUG_SERIAL.print(esp_rx_packet[ESP_PKT_DEVICE]);
   DEBUG_SERIAL.print(F(", LOG: "));
-  for (uint8_t i = 5; i < esp_rx_packet[4] + 5; i++) {
+  for (uint8_t i = ESP_PKT_DATA; i < esp_rx_packet[ESP_PKT_LENGTH] + ESP_PKT_DATA; i++) {
     if (esp_rx_packet[i] != '\n') DEBUG_SERIAL.write(esp_rx_packet[i]);
   }
   DEBUG_SERIAL.print(F(", COMMAND: "));
@@ -157,325 +160,368 @@ void command_log() {
   DEBUG_SERIAL.println(F("]"));
 }
 
-void command_confirm_set() {
-  if (confirm_wait) return;
-  if (command_data_len != 3) return;
-  int16_t new_value = ((((uint16_t)esp_rx_packet[7] << 8) & 0xFF00) | (esp_rx_packet[6] & 0x00FF));
-  if (new_value > 1500 || new_value < -1500) return;
-  uint8_t servo_id = ((esp_rx_packet[5] >> 2) & 0x01) + 1;
-  uint8_t value_type = (esp_rx_packet[5] & 0x03) - 1;
+// CMD_SET の bit2 と初期値送信(DCM_DSP)はサーボID 1〜DSP_SERVOS で舵面を指す (INDEX は get_index() で引くので aircraft[] の順は問わない)
+constexpr bool dsp_servos_present(uint8_t id = 1) {
+  return id > DSP_SERVOS || (surface_index(id) != 0xFF && dsp_servos_present(id + 1));
+}
+
+static_assert(SENSORY_SLOT_COUNT <= DSP_SERVOS, "servo IDs must fit in bit2 of CMD_SET (1 to DSP_SERVOS)");
+static_assert(dsp_servos_present(), "DCM_DSP needs a surface for every servo ID from 1 to DSP_SERVOS");
+
+// CMD_SET param: サーボINDEX, MIN|NEU|MAX, 角度
+bool command_check_set(uint16_t *param) {
+  int16_t new_value = command_data_int16(1);
+  if (new_value > 1500 || new_value < -1500) return false;
+  uint8_t target = esp_rx_packet[ESP_PKT_DATA];
+  uint8_t servo_id = ((target >> SET_SERVO_SHIFT) & SET_SERVO_MASK) + 1;
+  uint8_t value_type = (target & SET_TYPE_MASK) - 1;
+  if (value_type > MAX) return false;
   uint8_t index = get_index(servo_id);
-  if (index == 0xFF) return;
-  if (servo_info[index].val_threshold[value_type] == new_value) return;
+  if (index == 0xFF) return false;
+  if (servo_info[index].val_threshold[value_type] == new_value) return false;
   int16_t tmp_threshold[3] = {0};
   for (uint8_t i = 0; i < 3; i++) tmp_threshold[i] = servo_info[index].val_threshold[i];
   tmp_threshold[value_type] = new_value;
-  if (tmp_threshold[MIN] >= tmp_threshold[NEU] || tmp_threshold[MIN] >= tmp_threshold[MAX] || tmp_threshold[NEU] >= tmp_threshold[MAX]) return;
-  if (servo_info[index].sweep_mode || servo_info[index].test_mode) return;
-
-  esp_tx_packet[0]  = 0x8D;                                                   // ヘッダー
-  esp_tx_packet[1]  = 0xD8;                                                   // ヘッダー
-  esp_tx_packet[2]  = command_device;                                         // 送信先デバイスID
-  esp_tx_packet[3]  = (uint8_t)DCM_PRP;                                       // デバイス用コマンド
-  esp_tx_packet[4]  = (uint8_t)6;                                             // データ長
-  esp_tx_packet[5]  = command_id;                                             // データ：操舵基板コマンド確認用
-  esp_tx_packet[6]  = esp_rx_packet[5];                                       // データ：対象のサーボ角値指定
-  esp_tx_packet[7]  = lowByte (servo_info[index].val_threshold[value_type]);  // データ：変更前の値
-  esp_tx_packet[8]  = highByte(servo_info[index].val_threshold[value_type]);  // データ：変更前の値
-  esp_tx_packet[9]  = lowByte (new_value);                                    // データ：変更後の値
-  esp_tx_packet[10]  = highByte(new_value);                                   // データ：変更後の値
-  esp_tx_packet[11] = checksum(esp_tx_packet, 11);                            // チェックサム
-  ESP_SERIAL.write(esp_tx_packet, 12);                                        // 送信
-  ESP_SERIAL.flush();                                                         // 送信完了待ち
+  if (tmp_threshold[MIN] >= tmp_threshold[NEU] || tmp_threshold[MIN] >= tmp_threshold[MAX] || tmp_threshold[NEU] >= tmp_threshold[MAX]) return false;
+  if (servo_info[index].sweep_mode || servo_info[index].test_mode) return false;
+  param[0] = index;
+  param[1] = value_type;
+  param[2] = (uint16_t)new_value;
+  return true;
+}
 
-  confirm_wait = true;                        // 確認待ちを有効にする
-  confirm_wait_time = millis();               // 確認待ちの開始時間
-  confirm_command_id = command_id;            // 確認待ちのコマンド
-  confirm_device = command_device;
-  confirm_param[0] = (uint16_t)index;         // 確認待ちのコマンド処理用付加データ(サーボINDEX)
-  confirm_param[1] = (uint16_t)value_type;    // 確認待ちのコマンド処理用付加データ(MIN|NEU|MAXの区別)
-  confirm_param[2] = (uint16_t)new_value;     // 確認待ちのコマンド処理用付加データ(角度)
+uint8_t command_confirm_set(uint8_t *data, const uint16_t *param) {
+  int16_t old_value = servo_info[(uint8_t)param[0]].val_threshold[(uint8_t)param[1]];
+  data[0] = esp_rx_packet[ESP_PKT_DATA];                                        // データ：対象のサーボ角値指定
+  data[1] = lowByte (old_value);                                                // データ：変更前の値
+  data[2] = highByte(old_value);                                                // データ：変更前の値
+  data[3] = lowByte (param[2]);                                                 // データ：変更後の値
+  data[4] = highByte(param[2]);                                                 // データ：変更後の値
+  return 5;
 }
 
-void command_respond() {
-  if (command_data_len != 1) return;
-  switch (esp_rx_packet[5]) {
+void command_apply_set(const uint16_t *param) {
+  DEBUG_SERIAL.print(F("Executed Value Set ["));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].id);
+  DEBUG_SERIAL.print(F("] "));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].val_threshold[(uint8_t)param[1]]);
+  DEBUG_SERIAL.print(F(" ==> "));
+  DEBUG_SERIAL.println((int16_t)param[2]);
+  servo_info[(uint8_t)param[0]].val_threshold[(uint8_t)param[1]] = (int16_t)param[2];
+  servo_angle_eeprom_set((uint8_t)param[0], (uint8_t)param[1], (int16_t)param[2]);
+}
+
+void command_apply_request(const uint16_t *) {
+  switch (esp_rx_packet[ESP_PKT_DATA]) {
     case REQ_INI:
       DEBUG_SERIAL.println("Requested initial data");
       command_send_all();
       break;
+    case REQ_HLT:
+      command_send_health();
+      break;
+    case REQ_LNK:
+      command_send_links();
+      break;
+    case REQ_BUS:
+      command_send_bus();
+      break;
   }
 }
 
-void command_confirm_reboot() {
-  if (confirm_wait) return;
-  if (command_data_len != 1) return;
-  uint8_t servo_id = esp_rx_packet[5];
-  uint8_t index = get_index(servo_id);
-  if (index == 0xFF) return;
-  if (servo_info[index].sweep_mode) return;
-
-  esp_tx_packet[0] = 0x8D;                                      // ヘッダー
-  esp_tx_packet[1] = 0xD8;                                      // ヘッダー
-  esp_tx_packet[2] = command_device;                            // 送信先デバイスID
-  esp_tx_packet[3] = (uint8_t)DCM_PRP;                          // デバイス用コマンド
-  esp_tx_packet[4] = (uint8_t)2;                                // データ長
-  esp_tx_packet[5] = command_id;                                // データ：操舵基板用コマンドの種類
-  esp_tx_packet[6] = servo_id;                                  // データ：対象のサーボID
-  esp_tx_packet[7] = checksum(esp_tx_packet, 7);                // チェックサム
-  ESP_SERIAL.write(esp_tx_packet, 8);                           // 送信
-  ESP_SERIAL.flush();                                           // 送信完了待ち
+// CMD_RBT param: サーボINDEX
+bool command_check_reboot(uint16_t *param) {
+  uint8_t index = command_servo_index();
+  if (index == 0xFF) return false;
+  if (servo_info[index].sweep_mode) return false;
+  param[0] = index;
+  return true;
+}
 
-  confirm_wait = true;                        // 確認待ちを有効にする
-  confirm_wait_time = millis();               // 確認待ちの開始時間
-  confirm_command_id = command_id;            // 確認待ちのコマンド
-  confirm_device = command_device;
-  confirm_param[0] = (uint16_t)index;         // 確認待ちのコマンド処理用付加データ(サーボINDEX)
+uint8_t command_confirm_reboot(uint8_t *data, const uint16_t *param) {
+  data[0] = servo_info[(uint8_t)param[0]].id;                                   // データ：対象のサーボID
+  return 1;
 }
 
-void command_confirm_torque_percentage_set() {
-  if (confirm_wait) return;
-  if (command_data_len != 2) return;
-  uint8_t servo_id = esp_rx_packet[5];
-  uint8_t index = get_index(servo_id);
-  if (index == 0xFF) return;
-  uint8_t new_value = esp_rx_packet[6];
-  if (servo_info[index].torque_percentage == new_value) return;
-  if (new_value < 0 || new_value > 100) return;
-
-  esp_tx_packet[0] = 0x8D;                                        // ヘッダー
-  esp_tx_packet[1] = 0xD8;                                        // ヘッダー
-  esp_tx_packet[2] = command_device;                              // 送信先デバイスID
-  esp_tx_packet[3] = (uint8_t)DCM_PRP;                            // デバイス用コマンド
-  esp_tx_packet[4] = (uint8_t)4;                                  // データ長
-  esp_tx_packet[5] = command_id;                                  // データ：操舵基板用コマンドの種類
-  esp_tx_packet[6] = servo_id;                                    // データ：対象のサーボID
-  esp_tx_packet[7] = servo_info[index].torque_percentage;         // データ：変更前トルク%
-  esp_tx_packet[8] = new_value;                                   // データ：変更後トルク%
-  esp_tx_packet[9] = checksum(esp_tx_packet, 9);                  // チェックサム
-  ESP_SERIAL.write(esp_tx_packet, 10);                            // 送信
-  ESP_SERIAL.flush();                                             // 送信完了待ち
+void command_apply_reboot(const uint16_t *param) {
+  DEBUG_SERIAL.print(F("Executed Reboot Servo ID: "));
+  DEBUG_SERIAL.println(servo_info[(uint8_t)param[0]].id);
+  servo_reboot(servo_info[(uint8_t)param[0]].id);
+}
 
-  confirm_wait = true;                        // 確認待ちを有効にする
-  confirm_wait_time = millis();               // 確認待ちの開始時間
-  confirm_command_id = command_id;            // 確認待ちのコマンド
-  confirm_device = command_device;
-  confirm_param[0] = (uint16_t)index;         // 確認待ちのコマンド処理用付加データ(サーボINDEX)
-  confirm_param[1] = (uint16_t)new_value;     // 確認待ちのコマンド処理用付加データ(トルク%)
+// CMD_TQS param: サーボINDEX, トルク%
+bool command_check_torque_percentage_set(uint16_t *param) {
+  uint8_t index = command_servo_index();
+  if (index == 0xFF) return false;
+  uint8_t new_value = esp_rx_packet[ESP_PKT_DATA + 1];
+  if (servo_status[index].torque_percentage == new_value) return false;
+  if (new_value > 100) return false;
+  param[0] = index;
+  param[1] = new_value;
+  return true;
 }
 
-void command_confirm_torque_mode_set() {
-  if (confirm_wait) return;
-  if (command_data_len != 2) return;
-  uint8_t servo_id = esp_rx_packet[5];
-  uint8_t index = get_index(servo_id);
-  if (index == 0xFF) return;
-  uint8_t new_value = esp_rx_packet[6];
-  if (servo_info[index].torque_mode == new_value) return;
-  if (new_value < 0 || new_value > 2) return;
-  if (servo_info[index].sweep_mode) return;
-  if (new_value != 0x01 && servo_info[index].test_mode) return;
-
-  esp_tx_packet[0] = 0x8D;                                        // ヘッダー
-  esp_tx_packet[1] = 0xD8;                                        // ヘッダー
-  esp_tx_packet[2] = command_device;                              // 送信先デバイスID
-  esp_tx_packet[3] = (uint8_t)DCM_PRP;                            // デバイス用コマンド
-  esp_tx_packet[4] = (uint8_t)4;                                  // データ長
-  esp_tx_packet[5] = command_id;                                  // データ：操舵基板用コマンドの種類
-  esp_tx_packet[6] = servo_id;                                    // データ：対象のサーボID
-  esp_tx_packet[7] = servo_info[index].torque_mode;               // データ：変更前トルクモード
-  esp_tx_packet[8] = new_value;                                   // データ：変更後トルクモード
-  esp_tx_packet[9] = checksum(esp_tx_packet, 9);                  // チェックサム
-  ESP_SERIAL.write(esp_tx_packet, 10);                            // 送信
-  ESP_SERIAL.flush();                                             // 送信完了待ち
+uint8_t command_confirm_torque_percentage_set(uint8_t *data, const uint16_t *param) {
+  return command_confirm_change(data, servo_status[(uint8_t)param[0]].torque_percentage, param);
+}
 
-  confirm_wait = true;                        // 確認待ちを有効にする
-  confirm_wait_time = millis();               // 確認待ちの開始時間
-  confirm_command_id = command_id;            // 確認待ちのコマンド
-  confirm_device = command_device;
-  confirm_param[0] = (uint16_t)index;         // 確認待ちのコマンド処理用付加データ(サーボINDEX)
-  confirm_param[1] = (uint16_t)new_value;     // 確認待ちのコマンド処理用付加データ(トルクモード)
+void command_apply_torque_percentage_set(const uint16_t *param) {
+  DEBUG_SERIAL.print(F("Executed Torque Percentage Set ["));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].id);
+  DEBUG_SERIAL.print(F("] "));
+  DEBUG_SERIAL.print(servo_status[(uint8_t)param[0]].torque_percentage);
+  DEBUG_SERIAL.print(F(" ==> "));
+  DEBUG_SERIAL.println((uint8_t)param[1]);
+  servo_torque_value(servo_info[(uint8_t)param[0]].id, (uint8_t)param[1]);
 }
 
-void command_confirm_test_mode_set() {
-  if (confirm_wait) return;
-  if (command_data_len != 2) return;
-  uint8_t servo_id = esp_rx_packet[5];
-  uint8_t index = get_index(servo_id);
-  if (index == 0xFF) return;
-  uint8_t new_value = esp_rx_packet[6];
-  if (servo_info[index].test_mode == new_value) return;
-  if (new_value < 0 || new_value > 1) return;
-  if (servo_info[index].sweep_mode) return;
-  if (servo_info[index].torque_mode != 0x01) return;
-
-  esp_tx_packet[0] = 0x8D;                                        // ヘッダー
-  esp_tx_packet[1] = 0xD8;                                        // ヘッダー
-  esp_tx_packet[2] = esp_rx_packet[2];                            // 送信先デバイスID
-  esp_tx_packet[3] = (uint8_t)DCM_PRP;                            // デバイス用コマンド
-  esp_tx_packet[4] = (uint8_t)4;                                  // データ長
-  esp_tx_packet[5] = command_id;                                  // データ：操舵基板用コマンドの種類
-  esp_tx_packet[6] = servo_id;                                    // データ：対象のサーボID
-  esp_tx_packet[7] = servo_info[index].test_mode;                 // データ：変更前テストモード
-  esp_tx_packet[8] = new_value;                                   // データ：変更後テストモード
-  esp_tx_packet[9] = checksum(esp_tx_packet, 9);                  // チェックサム
-  ESP_SERIAL.write(esp_tx_packet, 10);                            // 送信
-  ESP_SERIAL.flush();                                             // 送信完了待ち
+// CMD_TMS param: サーボINDEX, トルクモード
+bool command_check_torque_mode_set(uint16_t *param) {
+  uint8_t index = command_servo_index();
+  if (index == 0xFF) return false;
+  uint8_t new_value = esp_rx_packet[ESP_PKT_DATA + 1];
+  if (servo_info[index].torque_mode == new_value) return false;
+  if (new_value > 2) return false;
+  if (servo_info[index].sweep_mode) return false;
+  if (new_value != 0x01 && servo_info[index].test_mode) return false;
+  param[0] = index;
+  param[1] = new_value;
+  return true;
+}
 
-  confirm_wait = true;                        // 確認待ちを有効にする
-  confirm_wait_time = millis();               // 確認待ちの開始時間
-  confirm_command_id = command_id;            // 確認待ちのコマンド
-  confirm_device = command_device;
-  confirm_param[0] = (uint16_t)index;         // 確認待ちのコマンド処理用付加データ(サーボINDEX)
-  confirm_param[1] = (uint16_t)new_value;     // 確認待ちのコマンド処理用付加データ(テストモード)
+uint8_t command_confirm_torque_mode_set(uint8_t *data, const uint16_t *param) {
+  return command_confirm_change(data, servo_info[(uint8_t)param[0]].torque_mode, param);
 }
 
-void command_test_move() {
-  int16_t tmp_value = ((((uint16_t)esp_rx_packet[7] << 8) & 0xFF00) | (esp_rx_packet[6] & 0x00FF));
-  if (tmp_value > 1500 || tmp_value < -1500) return;
-  uint8_t servo_id = esp_rx_packet[5];
-  uint8_t index = get_index(servo_id);
-  if (!servo_info[index].test_mode) return;
-  servo_info[index].val = tmp_value;
-  servo_move(servo_info[index].id, servo_info[index].val, 100);
+void command_apply_torque_mode_set(const uint16_t *param) {
+  DEBUG_SERIAL.print(F("Executed Torque Mode Set ["));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].id);
+  DEBUG_SERIAL.print(F("] "));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].torque_mode);
+  DEBUG_SERIAL.print(F(" ==> "));
+  DEBUG_SERIAL.println((uint8_t)param[1]);
+  servo_info[(uint8_t)param[0]].torque_mode = (uint8_t)param[1];
+  servo_set_torque_mode(servo_info[(uint8_t)param[0]].id, (uint8_t)param[1]);
 }
 
-void command_confirm_sweep() {
-  if (confirm_wait) return;
-  if (command_data_len != 2) return;
-  uint8_t servo_id = esp_rx_packet[5];
-  uint8_t index = get_index(servo_id);
-  if (index == 0xFF) return;
-  uint8_t new_value = 0x01;
-  uint8_t sweep_speed = esp_rx_packet[6];
-  if (servo_info[index].sweep_mode == new_value) return;
-  if (sweep_speed < 1 || sweep_speed > 2) return;
-  if (servo_info[index].torque_mode != 0x01) return;
-
-  esp_tx_packet[0] = 0x8D;                                        // ヘッダー
-  esp_tx_packet[1] = 0xD8;                                        // ヘッダー
-  esp_tx_packet[2] = esp_rx_packet[2];                            // 送信先デバイスID
-  esp_tx_packet[3] = (uint8_t)DCM_PRP;                            // デバイス用コマンド
-  esp_tx_packet[4] = (uint8_t)3;                                  // データ長
-  esp_tx_packet[5] = command_id;                                  // データ：操舵基板用コマンドの種類
-  esp_tx_packet[6] = servo_id;                                    // データ：対象のサーボID
-  esp_tx_packet[7] = sweep_speed;                                 // データ：試験動作の速さ
-  esp_tx_packet[8] = checksum(esp_tx_packet, 8);                  // チェックサム
-  ESP_SERIAL.write(esp_tx_packet, 9);                             // 送信
-  ESP_SERIAL.flush();                                             // 送信完了待ち
+// CMD_TMD param: サーボINDEX, テストモード
+bool command_check_test_mode_set(uint16_t *param) {
+  uint8_t index = command_servo_index();
+  if (index == 0xFF) return false;
+  uint8_t new_value = esp_rx_packet[ESP_PKT_DATA + 1];
+  if (servo_info[index].test_mode == new_value) return false;
+  if (new_value > 1) return false;
+  if (servo_info[index].sweep_mode) return false;
+  if (servo_info[index].torque_mode != 0x01) return false;
+  param[0] = index;
+  param[1] = new_value;
+  return true;
+}
 
-  confirm_wait = true;                        // 確認待ちを有効にする
-  confirm_wait_time = millis();               // 確認待ちの開始時間
-  confirm_command_id = command_id;            // 確認待ちのコマンド
-  confirm_device = command_device;
-  confirm_param[0] = (uint16_t)index;         // 確認待ちのコマンド処理用付加データ(サーボINDEX)
-  confirm_param[1] = (uint16_t)new_value;     // 確認待ちのコマンド処理用付加データ(試験動作モード)
-  confirm_param[2] = (uint16_t)sweep_speed;   // 確認待ちのコマンド処理用付加データ(試験動作の速さ)
+uint8_t command_confirm_test_mode_set(uint8_t *data, const uint16_t *param) {
+  return command_confirm_change(data, servo_info[(uint8_t)param[0]].test_mode, param);
+}
+
+void command_apply_test_mode_set(const uint16_t *param) {
+  DEBUG_SERIAL.print(F("Executed Test Mode Set ["));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].id);
+  DEBUG_SERIAL.print(F("] "));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].test_mode);
+  DEBUG_SERIAL.print(F(" ==> "));
+  DEBUG_SERIAL.println((uint8_t)param[1]);
+  servo_info[(uint8_t)param[0]].test_mode = (uint8_t)param[1];
+  servo_info[(uint8_t)param[0]].test_pending = false;
+}
+
+// CMD_TMV param: サーボINDEX, 目標位置
+// 目標位置は servo_control_all() で送信する (送信前に次の値が来たら上書き)
+bool command_check_test_move(uint16_t *param) {
+  int16_t tmp_value = command_data_int16(1);
+  if (tmp_value > 1500 || tmp_value < -1500) return false;
+  uint8_t index = command_servo_index();
+  if (index == 0xFF) return false;
+  if (!servo_info[index].test_mode) return false;
+  param[0] = index;
+  param[1] = (uint16_t)tmp_value;
+  return true;
+}
+
+void command_apply_test_move(const uint16_t *param) {
+  servo_test_post((uint8_t)param[0], (int16_t)param[1]);
+}
+
+// CMD_SWP param: サーボINDEX, 試験動作モード, 試験動作の速さ
+bool command_check_sweep(uint16_t *param) {
+  uint8_t index = command_servo_index();
+  if (index == 0xFF) return false;
+  uint8_t sweep_speed = esp_rx_packet[ESP_PKT_DATA + 1];
+  if (servo_info[index].sweep_mode) return false;
+  if (sweep_speed < 1 || sweep_speed > 2) return false;
+  if (servo_info[index].torque_mode != 0x01) return false;
+  param[0] = index;
+  param[1] = 0x01;
+  param[2] = sweep_speed;
+  return true;
 }
 
+uint8_t command_confirm_sweep(uint8_t *data, const uint16_t *param) {
+  data[0] = servo_info[(uint8_t)param[0]].id;                                   // データ：対象のサーボID
+  data[1] = (uint8_t)param[2];                                                  // データ：試験動作の速さ
+  return 2;
+}
+
+void command_apply_sweep(const uint16_t *param) {
+  DEBUG_SERIAL.print(F("Executed Sweep Mode Toggle ["));
+  DEBUG_SERIAL.print(servo_info[(uint8_t)param[0]].id);
+  DEBUG_SERIAL.print(F("] Speed : "));
+  DEBUG_SERIAL.println((uint8_t)param[2]);
+  servo_info[(uint8_t)param[0]].sweep_mode = (bool)param[1];
+  servo_info[(uint8_t)param[0]].sweep_speed = (uint8_t)param[2] - 1;
+  servo_info[(uint8_t)param[0]].sweep_last_step_time = millis();
+  servo_info[(uint8_t)param[0]].sweep_begin_time = millis();
+}
+
+const CommandEntry command_table[] PROGMEM = {
+  /* CMD_LOG */ {0, 0xFF, NULL,                                  NULL,                                  command_apply_log},
+  /* CMD_SET */ {3, 3,    command_check_set,                     command_confirm_set,                   command_apply_set},
+  /* CMD_REQ */ {1, 1,    NULL,                                  NULL,                                  command_apply_request},
+  /* CMD_RBT */ {1, 1,    command_check_reboot,                  command_confirm_reboot,                command_apply_reboot},
+  /* CMD_TQS */ {2, 2,    command_check_torque_percentage_set,   command_confirm_torque_percentage_set, command_apply_torque_percentage_set},
+  /* CMD_TMS */ {2, 2,    command_check_torque_mode_set,         command_confirm_torque_mode_set,       command_apply_torque_mode_set},
+  /* CMD_TMD */ {2, 2,    command_check_test_mode_set,           command_confirm_test_mode_set,         command_apply_test_mode_set},
+  /* CMD_TMV */ {3, 3,    command_check_test_move,               NULL,                                  command_apply_test_move},
+  /* CMD_SWP */ {2, 2,    command_check_sweep,                   command_confirm_sweep,                 command_apply_sweep},
+};
+
+#define COMMAND_COUNT (sizeof(command_table) / sizeof(command_table[0]))
+static_assert(COMMAND_COUNT == CMD_SWP + 1, "command_table must have one entry per CMD_* in order");
+
+// コマンド id の表の行を entry に読み出す (無ければ false)
+bool command_entry(uint8_t id, CommandEntry &entry) {
+  if (id >= COMMAND_COUNT) return false;
+  memcpy_P(&entry, &command_table[id], sizeof(entry));
+  return true;
+}
+
+// ESP からの確認応答(CMD_PRP)を受けて、確認待ちのコマンドを実行する
 void command_confirm() {
   if (!confirm_wait) return;
   if (confirm_device != command_device) return;
-  if (confirm_command_id != esp_rx_packet[5]) return;
+  if (confirm_command_id != esp_rx_packet[ESP_PKT_DATA + PRP_COMMAND]) return;
   confirm_wait = false;
-  if (esp_rx_packet[6] != 0x01) return;
-  switch (confirm_command_id) {
-    case CMD_SET:
-      DEBUG_SERIAL.print(F("Executed Value Set ["));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].id);
-      DEBUG_SERIAL.print(F("] "));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].val_threshold[(uint8_t)confirm_param[1]]);
-      DEBUG_SERIAL.print(F(" ==> "));
-      DEBUG_SERIAL.println((int16_t)confirm_param[2]);
-      servo_info[(uint8_t)confirm_param[0]].val_threshold[(uint8_t)confirm_param[1]] = (int16_t)confirm_param[2];
-      servo_angle_eeprom_set((uint8_t)confirm_param[0], (uint8_t)confirm_param[1], (int16_t)confirm_param[2]);
-      break;
-    case CMD_RBT:
-      DEBUG_SERIAL.print(F("Executed Reboot Servo ID: "));
-      DEBUG_SERIAL.println(servo_info[(uint8_t)confirm_param[0]].id);
-      servo_reboot(servo_info[(uint8_t)confirm_param[0]].id);
-      break;
-    case CMD_TQS:
-      DEBUG_SERIAL.print(F("Executed Torque Percentage Set ["));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].id);
-      DEBUG_SERIAL.print(F("] "));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].torque_percentage);
-      DEBUG_SERIAL.print(F(" ==> "));
-      DEBUG_SERIAL.println((uint8_t)confirm_param[1]);
-      servo_torque_value(servo_info[(uint8_t)confirm_param[0]].id, (uint8_t)confirm_param[1]);
-      break;
-    case CMD_TMS:
-      DEBUG_SERIAL.print(F("Executed Torque Mode Set ["));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].id);
-      DEBUG_SERIAL.print(F("] "));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].torque_mode);
-      DEBUG_SERIAL.print(F(" ==> "));
-      DEBUG_SERIAL.println((uint8_t)confirm_param[1]);
-      servo_info[(uint8_t)confirm_param[0]].torque_mode = (uint8_t)confirm_param[1];
-      servo_set_torque_mode(servo_info[(uint8_t)confirm_param[0]].id, (uint8_t)confirm_param[1]);
-      break;
-    case CMD_TMD:
-      DEBUG_SERIAL.print(F("Executed Test Mode Set ["));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].id);
-      DEBUG_SERIAL.print(F("] "));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].test_mode);
-      DEBUG_SERIAL.print(F(" ==> "));
-      DEBUG_SERIAL.println((uint8_t)confirm_param[1]);
-      servo_info[(uint8_t)confirm_param[0]].test_mode = (uint8_t)confirm_param[1];
-      break;
-    case CMD_SWP:
-      DEBUG_SERIAL.print(F("Executed Sweep Mode Toggle ["));
-      DEBUG_SERIAL.print(servo_info[(uint8_t)confirm_param[0]].id);
-      DEBUG_SERIAL.print(F("] Speed : "));
-      DEBUG_SERIAL.println((uint8_t)confirm_param[2]);
-      servo_info[(uint8_t)confirm_param[0]].sweep_mode = (bool)confirm_param[1];
-      servo_info[(uint8_t)confirm_param[0]].sweep_speed = (uint8_t)confirm_param[2] - 1;
-      servo_info[(uint8_t)confirm_param[0]].sweep_last_step_time = millis();
-      servo_info[(uint8_t)confirm_param[0]].sweep_begin_time = millis();
+  if (esp_rx_packet[ESP_PKT_DATA + PRP_ACCEPT] != 0x01) return;
+  CommandEntry entry;
+  if (command_entry(confirm_command_id, entry)) entry.apply(confirm_param);
+}
+
+void command_interpret() {
+  // DEBUG_SERIAL.println("Command ID is " + String(command_id));
+  if (command_id == CMD_PRP) {
+    if (command_data_len < PRP_DATA_LEN) return;
+    command_confirm();
+    command_send_all();
+    return;
+  }
+  CommandEntry entry;
+  if (!command_entry(command_id, entry)) return;
+  if (entry.confirm != NULL && confirm_wait) return;
+  if (command_data_len < entry.min_len || command_data_len > entry.max_len) return;
+  uint16_t param[3] = {0};
+  if (entry.check != NULL && !entry.check(param)) return;
+  if (entry.confirm == NULL) {
+    entry.apply(param);
+    return;
+  }
+
+  uint8_t *data = esp_packet_begin(esp_tx_packet, command_device, DCM_PRP);     // ヘッダー・送信先デバイスID・デバイス用コマンド
+  data[0] = command_id;                                                         // データ：操舵基板用コマンドの種類
+  uint8_t data_len = 1 + entry.confirm(data + 1, param);                        // データ：コマンドごとの確認内容
+  command_transmit(esp_packet_end(esp_tx_packet, data_len));                    // データ長・チェックサムを付けて送信
+
+  confirm_wait = true;                        // 確認待ちを有効にする
+  confirm_wait_time = millis();               // 確認待ちの開始時間
+  confirm_command_id = command_id;            // 確認待ちのコマンド
+  confirm_device = command_device;
+  memcpy(confirm_param, param, sizeof(confirm_param)); // 確認待ちのコマンド処理用付加データ
+}
+
+void command_handle() {
+  if (confirm_wait && millis() - confirm_wait_time > ESP_CONFIRM_COOLDOWN) confirm_wait = false;
+  // 溜まっているコマンドをまとめて処理する (試験モードの目標位置は最新のものだけが送信される)
+  // 返信の送信完了待ちは1フレームで数十msかかるので、返信を1つ送ったら残りは次の操舵の後に回す
+  command_replied = false;
+  for (uint8_t n = 0; n < COMMAND_BURST_MAX && !command_replied && command_receive(); n++) {
+    command_interpret();
   }
 }
 
+// 初期値送信パケットを esp_tx_packet に組み立て、パケット長を返す
+// 項目ごとにサーボID 1〜DSP_SERVOS の順に並べる (packet_schema.h の DSP_*)
+uint8_t command_build_all() {
+  uint8_t *data = EspPacket<DSP_DATA_LEN>::begin(esp_tx_packet, 0xFA, DCM_DSP);   // ヘッダー・送信先デバイスID・デバイス用コマンド・データ長
+  for (uint8_t id = 1; id <= DSP_SERVOS; id++) {
+    const ServoInfo &info = servo_info[get_index(id)];
+    for (uint8_t type = MIN; type <= MAX; type++) {
+      *data++ = set_target(id, type);                                             // データ：舵角 (CMD_SET の対象)
+      *data++ = lowByte (info.val_threshold[type]);                               // データ：舵角
+      *data++ = highByte(info.val_threshold[type]);                               // データ：舵角
+    }
+  }
+  for (uint8_t id = 1; id <= DSP_SERVOS; id++) {
+    *data++ = DSP_TEST + id - 1;                                                  // データ：テストモード
+    *data++ = (uint8_t)servo_info[get_index(id)].test_mode;                       // データ：テストモード
+  }
+  for (uint8_t id = 1; id <= DSP_SERVOS; id++) {
+    *data++ = DSP_TORQUE + id - 1;                                                // データ：トルクモード
+    *data++ = (uint8_t)servo_info[get_index(id)].torque_mode;                     // データ：トルクモード
+  }
+  for (uint8_t id = 1; id <= DSP_SERVOS; id++) {
+    const ServoInfo &info = servo_info[get_index(id)];
+    *data++ = DSP_SWEEP + id - 1;                                                 // データ：スイープモード
+    *data++ = (uint8_t)info.sweep_mode;                                           // データ：スイープモード
+    *data++ = (uint8_t)info.sweep_speed;                                          // データ：スイープ速度
+  }
+  return EspPacket<DSP_DATA_LEN>::end(esp_tx_packet);                            // チェックサム
+}
+
 void command_send_all() {
   // ----------初期値の送信--------------------------------------------------------------------- //
-  esp_tx_packet[0]  = 0x8D;                                       // ヘッダー
-  esp_tx_packet[1]  = 0xD8;                                       // ヘッダー
-  esp_tx_packet[2]  = 0xFA;                                       // 送信先デバイスID
-  esp_tx_packet[3]  = (uint8_t)DCM_DSP;                           // デバイス用コマンド
-  esp_tx_packet[4]  = (uint8_t)32;                                // データ長
-  esp_tx_packet[5]  = SET_RUD_MIN;                                // データ：ラダー最小
-  esp_tx_packet[6]  = lowByte (servo_info[0].val_threshold[MIN]); // データ：ラダー最小
-  esp_tx_packet[7]  = highByte(servo_info[0].val_threshold[MIN]); // データ：ラダー最小
-  esp_tx_packet[8]  = SET_RUD_NEU;                                // データ：ラダーニュ
-  esp_tx_packet[9]  = lowByte (servo_info[0].val_threshold[NEU]); // データ：ラダーニュ
-  esp_tx_packet[10] = highByte(servo_info[0].val_threshold[NEU]); // データ：ラダーニュ
-  esp_tx_packet[11] = SET_RUD_MAX;                                // データ：ラダー最大
-  esp_tx_packet[12] = lowByte (servo_info[0].val_threshold[MAX]); // データ：ラダー最大
-  esp_tx_packet[13] = highByte(servo_info[0].val_threshold[MAX]); // データ：ラダー最大
-  esp_tx_packet[14] = SET_ELE_MIN;                                // データ：エレベータ最小
-  esp_tx_packet[15] = lowByte (servo_info[1].val_threshold[MIN]); // データ：エレベータ最小
-  esp_tx_packet[16] = highByte(servo_info[1].val_threshold[MIN]); // データ：エレベータ最小
-  esp_tx_packet[17] = SET_ELE_NEU;                                // データ：エレベータニュ
-  esp_tx_packet[18] = lowByte (servo_info[1].val_threshold[NEU]); // データ：エレベータニュ
-  esp_tx_packet[19] = highByte(servo_info[1].val_threshold[NEU]); // データ：エレベータニュ
-  esp_tx_packet[20] = SET_ELE_MAX;                                // データ：エレベータ最大
-  esp_tx_packet[21] = lowByte (servo_info[1].val_threshold[MAX]); // データ：エレベータ最大
-  esp_tx_packet[22] = highByte(servo_info[1].val_threshold[MAX]); // データ：エレベータ最大
-  esp_tx_packet[23] = 0x08;                                       // データ：ラダーテストモード
-  esp_tx_packet[24] = (uint8_t)servo_info[0].test_mode;           // データ：ラダーテストモード
-  esp_tx_packet[25] = 0x09;                                       // データ：エレベータテストモード
-  esp_tx_packet[26] = (uint8_t)servo_info[1].test_mode;           // データ：エレベータテストモード
-  esp_tx_packet[27] = 0x0A;                                       // データ：ラダートルクモード
-  esp_tx_packet[28] = (uint8_t)servo_info[0].torque_mode;         // データ：ラダートルクモード
-  esp_tx_packet[29] = 0x0B;                                       // データ：エレベータトルクモード
-  esp_tx_packet[30] = (uint8_t)servo_info[1].torque_mode;         // データ：エレベータトルクモード
-  esp_tx_packet[31] = 0x0C;                                       // データ：ラダースイープモード
-  esp_tx_packet[32] = (uint8_t)servo_info[0].sweep_mode;          // データ：ラダースイープモード
-  esp_tx_packet[33] = (uint8_t)servo_info[0].sweep_speed;         // データ：ラダースイープモード
-  esp_tx_packet[34] = 0x0D;                                       // データ：エレベータスイープモード
-  esp_tx_packet[35] = (uint8_t)servo_info[1].sweep_mode;          // データ：エレベータスイープモード
-  esp_tx_packet[36] = (uint8_t)servo_info[1].sweep_speed;         // データ：エレベータスイープモード
-  esp_tx_packet[37] = checksum(esp_tx_packet, 37);                // チェックサム
-  ESP_SERIAL.write(esp_tx_packet, 38);                            // 送信
-  ESP_SERIAL.flush();                                             // 送信完了待ち
+  command_transmit(command_build_all());
   // ------------------------------------------------------------------------------------------ //
 }
+
+// サーボ index の健康状態の統計パケットを esp_tx_packet に組み立て、パケット長を返す
+uint8_t command_build_health(uint8_t index) {
+  static_assert(EspPacket<HLT_DATA_LEN>::length <= ESP_TX_PACKET_SIZE, "esp_tx_packet is too small for DCM_HLT");
+  uint8_t *data = EspPacket<HLT_DATA_LEN>::begin(esp_tx_packet, command_device, DCM_HLT); // ヘッダー・送信先デバイスID・デバイス用コマンド・データ長
+  servo_health_put(data, index);                                                        // データ：統計 (HLT_*)
+  return EspPacket<HLT_DATA_LEN>::end(esp_tx_packet);                                   // チェックサム
+}
+
+void command_send_health() {
+  for (uint8_t i = 0; i < servo_count; i++) command_transmit(command_build_health(i));
+}
+
+// シリアル link の通信量・エラーの集計パケットを esp_tx_packet に組み立て、パケット長を返す
+uint8_t command_build_link(uint8_t link) {
+  static_assert(EspPacket<LNK_DATA_LEN>::length <= ESP_TX_PACKET_SIZE, "esp_tx_packet is too small for DCM_LNK");
+  uint8_t *data = EspPacket<LNK_DATA_LEN>::begin(esp_tx_packet, command_device, DCM_LNK); // ヘッダー・送信先デバイスID・デバイス用コマンド・データ長
+  link_stats_put(data, link);                                                           // データ：集計 (LNK_*)
+  return EspPacket<LNK_DATA_LEN>::end(esp_tx_packet);                                   // チェックサム
+}
+
+void command_send_links() {
+  for (uint8_t link = 0; link < LINKS; link++) command_transmit(command_build_link(link));
+}
+
+// 直前の集計区間のサーボバス使用状況パケットを esp_tx_packet に組み立て、パケット長を返す
+uint8_t command_build_bus() {
+  static_assert(EspPacket<BUS_DATA_LEN>::length <= ESP_TX_PACKET_SIZE, "esp_tx_packet is too small for DCM_BUS");
+  uint8_t *data = EspPacket<BUS_DATA_LEN>::begin(esp_tx_packet, command_device, DCM_BUS); // ヘッダー・送信先デバイスID・デバイス用コマンド・データ長
+  servo_bus_put(data);                                                                  // データ：集計 (BUS_*)
+  return EspPacket<BUS_DATA_LEN>::end(esp_tx_packet);                                   // チェックサム
+}
+
+void command_send_bus() {
+  command_transmit(command_build_bus());
+}
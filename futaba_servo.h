@@ -1,128 +1,242 @@
 #include "tone.h"
+#include "packet_schema.h"
+#include "aircraft_config.h"
+#include "serial_link.h"
+#include "memory_report.h"
 #include <EEPROM.h>
 
 #define SERVO_SERIAL Serial2
 #define SERVO_BAUDRATE 9600
 
-#define SERVO_COUNT_MAX 2
+#define SERVO_COUNT_MAX AIRCRAFT_SURFACES // 舵面の数 (aircraft_config.h)
 
 #define TAIL_COMM_ENABLE_PIN 8
 
 #define REQUEST_COOLDOWN 200UL
-#define DEBUG_COOLDOWN 200UL
+#define REQUEST_BACKOFF_MAX 1600UL // 返信の無いサーボへの読み出し間隔の上限(ms)
+#define DEBUG_COOLDOWN 200UL      // 舵面ごとの行の出力間隔(ms) (送信バッファ 64byte に収まる長さにする)
+#define DEBUG_MEMORY_COOLDOWN 10000UL // RAM 使用量の行の出力間隔(ms)
+
+// リターンパケット待ち時間(us)
+#define SERVO_BYTE_TIME (10000000UL / SERVO_BAUDRATE) // 1バイトの通信時間
+#define SERVO_TIMEOUT_MIN 1000UL                      // 応答時間推定値から決める待ち時間の下限
+#define SERVO_TIMEOUT_MAX 10000UL                     // 応答時間の推定値が無いときの待ち時間・待ち時間の上限
+#define SERVO_LOST_FAILS 3                            // 連続で返信が無ければ応答しなくなったとみなす回数
+#define SERVO_TIMEOUT_BACKOFF 4                       // 返信が無いときに待ち時間を倍にする回数の上限 (MIN << 4 で MAX を超える)
 
 #define MIN 0
 #define NEU 1
 #define MAX 2
 
-#define SERVO_COMM_MAX_BYTES 32
-
 // 尾翼サーボ用送受信パケット
-uint8_t servo_tx_packet[SERVO_COMM_MAX_BYTES] = {0}; //送信用パケット
-uint8_t servo_rx_packet[SERVO_COMM_MAX_BYTES] = {0}; //受信用パケット
+uint8_t servo_tx_packet[ServoMovePacket::length] = {0};  //送信用パケット (最長は目標位置の書き込み)
+uint8_t servo_rx_packet[SERVO_INFO_REPLY_LEN] = {0};     //受信用パケット (最長は定期読み出しブロックの返信)
 
 #define SWEEP_STEPS 8
 
-int16_t sweep_durations[2][SWEEP_STEPS] = {
+const uint16_t sweep_durations[2][SWEEP_STEPS] PROGMEM = {
   {0, 100, 250, 100, 500, 100, 250, 100}, // 低速試験動作　時間(10ms) 合計14秒以上
   {0, 10, 50, 0, 100, 0, 50, 0}   // 高速試験動作　時間(10ms) 合計2.1秒以上
 };
 
-uint8_t sweep_angles[SWEEP_STEPS] = {
+const uint8_t sweep_angles[SWEEP_STEPS] PROGMEM = {
   NEU, NEU, MIN, MIN, MAX, MAX, NEU, NEU
 };
 
-typedef struct ServoInfo {
-  uint8_t id;
-  String alias;
-
-  int16_t controller_pin;
+#define sweep_duration(speed, step) ((uint16_t)pgm_read_word(&sweep_durations[(speed)][(step)]))
+#define sweep_angle(step) pgm_read_byte(&sweep_angles[(step)])
 
-  int16_t l_min = 0;
-  int16_t c_min = 500;
-  int16_t c_max = 524;
-  int16_t h_max = 1023;
+// 操舵に使う状態 (servo_control_all() で毎回参照する)
+// ピン・操縦桿の電圧値範囲・反転は aircraft_config.h の定数で、ここには持たない
+typedef struct ServoInfo {
+  uint8_t id;                       // aircraft[INDEX].id (INDEX が変数の処理用)
+  const __FlashStringHelper *alias; // フラッシュ上の文字列
 
   int16_t control_value;
-  int16_t val = 0;
-  int16_t val_threshold[3] = { -50, 0, 50};
-
+  int16_t val;
+  int16_t val_threshold[3]; // EEPROM に保存する舵角
 
-  boolean reverse = false; // false -> 通常, true -> ジョイスティックの読みを反転させる
-  uint8_t adjusted_max = (uint8_t)MAX; // reverse = false -> MAX, reverse = true -> MIN
-  uint8_t adjusted_min = (uint8_t)MIN; // reverse = false -> MIN, reverse = true -> MAX
+  uint8_t test_mode : 1;
+  uint8_t sweep_mode : 1;
+  uint8_t sweep_speed : 1; // 0: 低速 1: 高速
+  uint8_t torque_mode : 2; // 0: OFF 1: ON 2: BREAK
+  uint8_t sweep_next_step : 4;
+  uint8_t test_pending : 1; // test_value が未送信
 
-  boolean test_mode = false;
-  boolean sweep_mode = false;
+  int16_t test_value;      // 試験モードの目標位置 (ESP から受けた最新の値だけを次の操舵で送信する)
 
-  uint8_t sweep_speed = 0;
-  uint8_t sweep_next_step = 0;
-  uint32_t sweep_begin_time = 0;
-  uint32_t sweep_last_step_time = 0;
+  uint32_t sweep_begin_time;
+  uint32_t sweep_last_step_time;
+} ServoInfo;
 
+// サーボから読み出した状態と通信状況
+typedef struct ServoStatus {
+  uint8_t actual_torque_mode;
+  uint8_t torque_percentage;
+  int16_t actual_position;
+  int16_t load;
+  int16_t temperature;
+  int16_t voltage;
+  uint8_t temp_limit : 1;
+  uint8_t temp_limit_alarm : 1;
+  uint8_t rom_write_error : 1;
+  uint8_t packet_error : 1;
+  uint8_t torque_sync : 1;    // 再起動・トルクモード設定後、状態を読み出すまで 1
+  uint8_t est_valid : 1;      // 位置推定の起点がある
+
+  uint8_t fail_count;         // 連続で返信が無かった回数
+  uint16_t request_interval;  // 読み出し間隔(ms) 返信が無いと倍々に伸ばす
   uint32_t last_request_time;
+  uint16_t rtt_mean;          // 送信完了から返信の最初のバイトまでの時間の平均(us) 0: 未計測
+  uint16_t rtt_dev;           // 同平均偏差(us)
+  uint16_t test_dropped;      // 送信前に新しい値で上書きされた試験モードの目標位置の数
 
-  uint8_t torque_mode = 1;
-  uint8_t actual_torque_mode = 0;
-  uint8_t torque_percentage = 100;
-  int16_t actual_position = 0;
-  uint8_t temp_limit = 0;
-  uint8_t temp_limit_alarm = 0;
-  uint8_t rom_write_error = 0;
-  uint8_t packet_error = 0;
-  int16_t load = 0;
-  int16_t temperature = 0;
-  int16_t voltage = 0;
-} ServoInfo;
+  int16_t est_origin;         // 位置推定の起点 (最後に読み出した現在位置)
+  uint16_t est_rate;          // 推定移動速度(0.1度/s)
+  uint32_t est_time;          // 起点を読み出した時刻(ms)
+} ServoStatus;
 
 ServoInfo servo_info[SERVO_COUNT_MAX];
+ServoStatus servo_status[SERVO_COUNT_MAX];
 
-int16_t servo_count = 0;
+const uint8_t servo_count = SERVO_COUNT_MAX;
 
-uint32_t last_debug_time = 0;
+// サーボ INDEX 0 〜 SERVO_COUNT_MAX - 1 について F<INDEX>::run() を順に呼ぶ (ループを展開する)
+template <template <uint8_t> class F, uint8_t I = 0, bool END = (I >= SERVO_COUNT_MAX)> struct ForEachServo {
+  static inline void run() {
+    F<I>::run();
+    ForEachServo<F, I + 1>::run();
+  }
+};
 
-// ID から DATA の末尾までの各バイトのXOR
-byte checksum(uint8_t * data, uint8_t len) {
-  byte sum = 0;
-  for (uint8_t i = 2; i < len; i++) sum ^= data[i];
-  return sum;
-}
+template <template <uint8_t> class F, uint8_t I> struct ForEachServo<F, I, true> {
+  static inline void run() {}
+};
 
-void transmit_packet(uint8_t len) {
+uint32_t last_debug_time = 0;
+uint32_t last_memory_time = 0;
+
+void transmit_packet(const uint8_t *packet, uint8_t len) {
   digitalWrite(TAIL_COMM_ENABLE_PIN, HIGH);       //送信許可
-  SERVO_SERIAL.write(servo_tx_packet, len);            //サーボに送信
-  SERVO_SERIAL.flush();                            //リードバッファを初期化(送信データがすべて送信されるまで待つ)
+  link_write(SERVO_SERIAL, LINK_SERVO, packet, len); //サーボに送信
+  link_flush(SERVO_SERIAL, LINK_SERVO);           //リードバッファを初期化(送信データがすべて送信されるまで待つ)
   digitalWrite(TAIL_COMM_ENABLE_PIN, LOW);        //送信禁止
 }
 
+// ---------- サーボバス調停 ------------------------------------------------------------------- //
+// サーボへのパケットは直接送信せず、優先度付きのスロットに積んでから servo_bus_service() で送信する
+// 優先度の高いクラスから順に送信し、同じクラスの中では積んだ順に送信する
+// 同じサーボ・同じアドレスへのパケットが未送信のまま残っていれば新しい内容で上書きする
+
+#define BUS_CONTROL     0 // 操舵(目標位置の書き込み)
+#define BUS_MAINTENANCE 1 // トルクモード・トルク%の書き込み、再起動
+#define BUS_TELEMETRY   2 // 状態の読み出し
+#define BUS_CLASSES     3
+
+#define BUS_SLOTS 8
+#define BUS_SLOT_BYTES 12 // 送信パケットの最大長 (ServoMovePacket)
+
+typedef struct BusSlot {
+  bool pending = false;
+  uint8_t priority;           // BUS_CONTROL | BUS_MAINTENANCE | BUS_TELEMETRY
+  uint8_t order;              // 積んだ順番
+  uint8_t len;                // 送信パケット長
+  uint8_t reply_len;          // リターンパケットのデータ長 (0: 返信なし)
+  uint8_t quiet_time;         // 送信後にバスを空ける時間(ms)
+  uint8_t index;              // 宛先のサーボINDEX (リターンパケットの展開先、再起動の回数の記録先)
+  uint8_t *reply_packet;      // リターンパケットの展開先(計測基板用スロット)
+  uint32_t submit_time;       // 積んだ時刻(us)
+  uint8_t packet[BUS_SLOT_BYTES];
+} BusSlot;
+
+BusSlot bus_slot[BUS_SLOTS];
+uint8_t bus_order = 0;
+
+uint32_t bus_quiet_begin = 0;       // バスを空け始めた時刻(ms)
+uint8_t bus_quiet_time = 0;         // バスを空ける時間(ms)
+
+// クラス別のバス使用状況 (servo_bus_window() で bus_last に移してリセット)
+typedef struct BusStats {
+  uint32_t busy_time[BUS_CLASSES];   // 送受信に使った時間(us)
+  uint32_t wait_max[BUS_CLASSES];    // 積んでから送信開始までの最大待ち時間(us)
+  uint16_t dropped[BUS_CLASSES];     // スロット不足で積めなかった回数
+  uint32_t window;                   // 集計時間(us) (bus_last のみ)
+} BusStats;
+
+BusStats bus_stats;                  // 集計中
+BusStats bus_last;                   // 直前の集計区間 (ESP からは CMD_REQ / REQ_BUS で読み出す)
+uint32_t bus_window_begin = 0;       // 集計開始時刻(us)
+
+// servo_tx_packet に組み立て済みのパケットをスロットに積む
+bool servo_bus_submit(uint8_t priority, uint8_t len, uint8_t quiet_time = 0, uint8_t reply_len = 0, uint8_t index = 0xFF, uint8_t *reply_packet = NULL) {
+  BusSlot *slot = NULL;
+  for (uint8_t i = 0; i < BUS_SLOTS; i++) {
+    if (!bus_slot[i].pending) {
+      if (slot == NULL) slot = &bus_slot[i];
+      continue;
+    }
+    // 未送信の同じ宛先(ID・フラグ・アドレス)のパケットは上書きする
+    if (bus_slot[i].priority == priority
+        && bus_slot[i].packet[SERVO_PKT_ID] == servo_tx_packet[SERVO_PKT_ID]
+        && bus_slot[i].packet[SERVO_PKT_FLAGS] == servo_tx_packet[SERVO_PKT_FLAGS]
+        && bus_slot[i].packet[SERVO_PKT_ADDRESS] == servo_tx_packet[SERVO_PKT_ADDRESS]) {
+      slot = &bus_slot[i];
+      break;
+    }
+  }
+  if (slot == NULL || len > BUS_SLOT_BYTES) {
+    bus_stats.dropped[priority]++;
+    return false;
+  }
+  if (!slot->pending) {
+    slot->order = bus_order++;
+    slot->submit_time = micros();
+  }
+  slot->priority = priority;
+  slot->len = len;
+  slot->reply_len = reply_len;
+  slot->quiet_time = quiet_time;
+  slot->index = index;
+  slot->reply_packet = reply_packet;
+  memcpy(slot->packet, servo_tx_packet, len);
+  slot->pending = true;
+  return true;
+}
+
+// priority のクラスのパケットがサーボ id 宛てに積まれているか
+bool servo_bus_pending(uint8_t priority, uint8_t id) {
+  for (uint8_t i = 0; i < BUS_SLOTS; i++) {
+    if (bus_slot[i].pending && bus_slot[i].priority == priority && bus_slot[i].packet[SERVO_PKT_ID] == id) return true;
+  }
+  return false;
+}
+
+// 再起動パケットを servo_tx_packet に組み立て、パケット長を返す
+uint8_t servo_build_reboot(uint8_t id) {
+  ServoRebootPacket::begin(servo_tx_packet, id);
+  return ServoRebootPacket::end(servo_tx_packet);
+}
+
+uint8_t get_index(uint8_t id);
+void servo_health_reboot(uint8_t index);
+void servo_health_sample(uint8_t index, bool received);
+
+// 再起動後30msはバスを空ける (再起動の回数は servo_bus_service() で実際に送信したときに数える)
 void servo_reboot(uint8_t id) {
-  servo_tx_packet[0] = 0xFA;                                     //Header
-  servo_tx_packet[1] = 0xAF;                                     //Header
-  servo_tx_packet[2] = id;                                       //ID
-  servo_tx_packet[3] = 0x20;                                     //Flags
-  servo_tx_packet[4] = 0xFF;                                     //Address
-  servo_tx_packet[5] = 0x00;                                     //Length
-  servo_tx_packet[6] = 0x00;                                     //Count
-  servo_tx_packet[7] = checksum(servo_tx_packet, 7);               //sum
+  servo_bus_submit(BUS_MAINTENANCE, servo_build_reboot(id), 30, 0, get_index(id));
+}
 
-  transmit_packet(8);
-  delay(30);
+// トルク％設定パケットを組み立て、パケット長を返す
+uint8_t servo_build_torque_value(uint8_t id, uint8_t value) {
+  uint8_t *data = ServoTorqueValuePacket::begin(servo_tx_packet, id);
+  data[0] = value;                                               //トルク%
+  return ServoTorqueValuePacket::end(servo_tx_packet);
 }
 
 // サーボのトルク％を設定(基本使わない)
 void servo_torque_value(uint8_t id, uint8_t value) {
-  servo_tx_packet[0] = 0xFA;                                     //Header
-  servo_tx_packet[1] = 0xAF;                                     //Header
-  servo_tx_packet[2] = id;                                       //ID
-  servo_tx_packet[3] = 0x00;                                     //Flags
-  servo_tx_packet[4] = 0x23;                                     //Address
-  servo_tx_packet[5] = 0x01;                                     //Length
-  servo_tx_packet[6] = 0x01;                                     //Count
-  servo_tx_packet[7] = (uint8_t)value;                           //ON/OFF
-  servo_tx_packet[8] = checksum(servo_tx_packet, 8);               //sum
-
-  if (!(0 <= value && value <= 100)) return;
-  transmit_packet(9);
+  if (value > 100) return;
+  servo_bus_submit(BUS_MAINTENANCE, servo_build_torque_value(id, value));
 }
 
 // トルクの種類を設定
@@ -131,93 +245,106 @@ void servo_torque_value(uint8_t id, uint8_t value) {
 // 0: OFF
 // 1: ON
 // 2: BREAK MODE (手で動かせるぐらいの弱いトルクにする)
-void servo_set_torque_mode(uint8_t id, uint8_t state) {
-  servo_tx_packet[0] = 0xFA;                                     //Header
-  servo_tx_packet[1] = 0xAF;                                     //Header
-  servo_tx_packet[2] = id;                                       //ID
-  servo_tx_packet[3] = 0x00;                                     //Flags
-  servo_tx_packet[4] = 0x24;                                     //Address
-  servo_tx_packet[5] = 0x01;                                     //Length
-  servo_tx_packet[6] = 0x01;                                     //Count
-  servo_tx_packet[7] = (uint8_t) state & 0x00FF;                    //ON/OFF
-  servo_tx_packet[8] = checksum(servo_tx_packet, 8);               //sum
+uint8_t servo_build_torque_mode(uint8_t id, uint8_t state) {
+  uint8_t *data = ServoTorqueModePacket::begin(servo_tx_packet, id);
+  data[0] = state;                                               //ON/OFF
+  return ServoTorqueModePacket::end(servo_tx_packet);
+}
 
+void servo_set_torque_mode(uint8_t id, uint8_t state) {
   if (!(state == 0 || state == 1 || state == 2)) return;
-  transmit_packet(9);
+  servo_bus_submit(BUS_MAINTENANCE, servo_build_torque_mode(id, state));
 }
 
+// 目標位置・目標時間の書き込みパケットを組み立て、パケット長を返す
+uint8_t servo_build_move(uint8_t id, uint16_t o_angle, uint16_t o_time) {
+  uint8_t *data = ServoMovePacket::begin(servo_tx_packet, id);
+  ServoMoveAngle::put(data, o_angle);                   //目標位置データ
+  ServoMoveTime::put(data, o_time);                     //目標時間データ
+  return ServoMovePacket::end(servo_tx_packet);
+}
 
 void servo_move(uint8_t id, uint16_t o_angle, uint16_t o_time) {
-  servo_tx_packet[0] = 0xFA;                            //Header
-  servo_tx_packet[1] = 0xAF;                            //Header
-  servo_tx_packet[2] = id;                              //ID
-  servo_tx_packet[3] = 0x00;                            //Flags
-  servo_tx_packet[4] = 0x1E;                            //Address
-  servo_tx_packet[5] = 0x04;                            //Length
-  servo_tx_packet[6] = 0x01;                            //Count
-  servo_tx_packet[7] = lowByte(o_angle);                //目標位置データ(下位バイト)
-  servo_tx_packet[8] = highByte(o_angle);               //目標位置データ(上位バイト)
-  servo_tx_packet[9] = lowByte(o_time);                 //目標時間データ(下位バイト)
-  servo_tx_packet[10] = highByte(o_time);               //目標時間データ(上位バイト)
-  servo_tx_packet[11] = checksum(servo_tx_packet, 11);    //Checksum
-
-  transmit_packet(12);
+  servo_bus_submit(BUS_CONTROL, servo_build_move(id, o_angle, o_time));
 }
 
-void servo_angle_eeprom_set(uint8_t id, uint8_t type, int16_t val) {
-  EEPROM.put(id * 6 + type * 2, val);
+// サーボ index の舵角 type(MIN/NEU/MAX) を EEPROM に保存する (サーボ1台につき6バイト)
+void servo_angle_eeprom_set(uint8_t index, uint8_t type, int16_t val) {
+  EEPROM.put(index * 6 + type * 2, val);
 }
 
+// サーボID 0〜SENSORY_SLOT_COUNT の INDEX の表 (aircraft[] からコンパイル時に作る)
+template <uint8_t... ID> struct ServoIdTable {
+  static constexpr uint8_t index[sizeof...(ID)] = {surface_index(ID)...};
+};
+template <uint8_t... ID> constexpr uint8_t ServoIdTable<ID...>::index[sizeof...(ID)];
+
+template <uint8_t N, uint8_t... ID> struct MakeServoIdTable : MakeServoIdTable<N - 1, N - 1, ID...> {};
+template <uint8_t... ID> struct MakeServoIdTable<0, ID...> : ServoIdTable<ID...> {};
+
+typedef MakeServoIdTable<SENSORY_SLOT_COUNT + 1> ServoIds;
+
+// サーボID の INDEX (登録されていなければ 0xFF)
 uint8_t get_index(uint8_t id) {
-  for (uint8_t i = 0; i < servo_count; i++) {
-    if (servo_info[i].id == id) return i;
-  }
-  return 0xFF;
+  return id <= SENSORY_SLOT_COUNT ? ServoIds::index[id] : 0xFF;
 }
 
-bool servo_add(uint8_t id, String alias, int16_t controller_pin, int16_t l_min, int16_t c_min, int16_t c_max, int16_t h_max, int16_t val_min, int16_t val_neu, int16_t val_max, bool reverse) {
-  if (servo_count >= SERVO_COUNT_MAX) return false;
-  if (val_min == val_neu) {
-    val_min--;
-    servo_angle_eeprom_set(id, MIN, val_min);
+// サーボ index の舵角を EEPROM から読み込む
+// MIN・MAX がニュートラルと同じなら1だけずらす
+// 書き込み前(0xFFFF)・範囲外・大小関係が崩れていれば既定値 val_min, val_neu, val_max を使い、EEPROM はそのままにする
+// ずらした値を使うときだけ、変わった値を EEPROM に書き戻す
+void servo_angle_load(uint8_t index, int16_t val_min, int16_t val_neu, int16_t val_max) {
+  int16_t stored[3];
+  int16_t *val = servo_info[index].val_threshold;
+  for (uint8_t type = MIN; type <= MAX; type++) {
+    EEPROM.get(index * 6 + type * 2, stored[type]);
+    val[type] = stored[type];
   }
-  if (val_max == val_neu) {
-    val_max++;
-    servo_angle_eeprom_set(id, MAX, val_max);
+  if (val[MIN] == -1 && val[NEU] == -1 && val[MAX] == -1) {
+    val[MIN] = val_min;
+    val[NEU] = val_neu;
+    val[MAX] = val_max;
+    return;
   }
-  if (val_min < -1500 || val_min > 1500) return false;
-  if (val_neu < -1500 || val_neu > 1500) return false;
-  if (val_max < -1500 || val_max > 1500) return false;
-  servo_info[servo_count].id = id;
-  servo_info[servo_count].alias = alias;
-  servo_info[servo_count].controller_pin = controller_pin;
-  servo_info[servo_count].l_min = l_min;
-  servo_info[servo_count].h_max = h_max;
-  servo_info[servo_count].c_min = c_min;
-  servo_info[servo_count].c_max = c_max;
-  servo_info[servo_count].val_threshold[MIN] = val_min;
-  servo_info[servo_count].val_threshold[NEU] = val_neu;
-  servo_info[servo_count].val_threshold[MAX] = val_max;
-  servo_info[servo_count].reverse = reverse;
-  if (!servo_info[servo_count].reverse) {
-    servo_info[servo_count].adjusted_min = MIN;
-    servo_info[servo_count].adjusted_max = MAX;
-  } else {
-    servo_info[servo_count].adjusted_min = MAX;
-    servo_info[servo_count].adjusted_max = MIN;
+  if (val[MIN] == val[NEU]) val[MIN]--;
+  if (val[MAX] == val[NEU]) val[MAX]++;
+  if (val[MIN] < -ANGLE_LIMIT || val[MAX] > ANGLE_LIMIT || val[MIN] >= val[NEU] || val[NEU] >= val[MAX]) {
+    val[MIN] = val_min;
+    val[NEU] = val_neu;
+    val[MAX] = val_max;
+    return;
+  }
+  for (uint8_t type = MIN; type <= MAX; type++) {
+    if (val[type] != stored[type]) servo_angle_eeprom_set(index, type, val[type]);
+  }
+}
+
+// サーボ INDEX I の設定を aircraft_config.h から取り込む
+template <uint8_t I> struct ServoInit {
+  static void run() {
+    static_assert(SurfaceCheck<I>::ok, "");
+    servo_info[I].id = aircraft[I].id;
+    servo_info[I].alias = reinterpret_cast<const __FlashStringHelper *>(aircraft[I].alias);
+    servo_angle_load(I, aircraft[I].angle[MIN], aircraft[I].angle[NEU], aircraft[I].angle[MAX]);
+    servo_info[I].torque_mode = 1;
+    servo_status[I].torque_percentage = 100;
+    servo_status[I].request_interval = REQUEST_COOLDOWN;
+    pinMode(aircraft[I].pin, INPUT);
   }
-  servo_count++;
-  pinMode(controller_pin, INPUT);
-  return true;
 };
 
+void servo_init() {
+  ForEachServo<ServoInit>::run();
+}
+
 void command_send_all();
 
 void servo_maintain() {
   for (uint8_t i = 0; i < servo_count; i++) {
-    if (servo_info[i].actual_torque_mode != servo_info[i].torque_mode) {
+    if (servo_status[i].actual_torque_mode != servo_info[i].torque_mode && !servo_status[i].torque_sync) {
       servo_reboot(servo_info[i].id);
       servo_set_torque_mode(servo_info[i].id, servo_info[i].torque_mode);
+      servo_status[i].torque_sync = true;
     }
     if (servo_info[i].sweep_mode) {
       if (millis() - servo_info[i].sweep_begin_time > 12500) {
@@ -226,7 +353,7 @@ void servo_maintain() {
         command_send_all();
         continue;
       }
-      if (millis() - servo_info[i].sweep_last_step_time < sweep_durations[servo_info[i].sweep_speed][servo_info[i].sweep_next_step] * 10) continue;
+      if (millis() - servo_info[i].sweep_last_step_time < sweep_duration(servo_info[i].sweep_speed, servo_info[i].sweep_next_step) * 10UL) continue;
       servo_info[i].sweep_next_step++;
       if (servo_info[i].sweep_next_step >= SWEEP_STEPS) {
         servo_info[i].sweep_mode = false;
@@ -234,135 +361,322 @@ void servo_maintain() {
         command_send_all();
         continue;
       }
-      servo_info[i].val = servo_info[i].val_threshold[sweep_angles[servo_info[i].sweep_next_step]];
-      servo_move(servo_info[i].id, servo_info[i].val_threshold[sweep_angles[servo_info[i].sweep_next_step]], sweep_durations[servo_info[i].sweep_speed][servo_info[i].sweep_next_step]);
+      servo_info[i].val = servo_info[i].val_threshold[sweep_angle(servo_info[i].sweep_next_step)];
+      servo_move(servo_info[i].id, servo_info[i].val_threshold[sweep_angle(servo_info[i].sweep_next_step)], sweep_duration(servo_info[i].sweep_speed, servo_info[i].sweep_next_step));
       servo_info[i].sweep_last_step_time = millis();
       DEBUG_SERIAL.print(F("Moved sweep ID: "));
-      DEBUG_SERIAL.print(servo_info[i].id);
+      DEBUG_SERIAL.print(servo_info[i].alias);
       DEBUG_SERIAL.print(F(" step: "));
       DEBUG_SERIAL.print(servo_info[i].sweep_next_step);
       DEBUG_SERIAL.print(F(" angle: "));
-      DEBUG_SERIAL.print(servo_info[i].val_threshold[sweep_angles[servo_info[i].sweep_next_step]]);
+      DEBUG_SERIAL.print(servo_info[i].val_threshold[sweep_angle(servo_info[i].sweep_next_step)]);
       DEBUG_SERIAL.print(F(" duration: "));
-      DEBUG_SERIAL.println(sweep_durations[servo_info[i].sweep_speed][servo_info[i].sweep_next_step] * 10);
+      DEBUG_SERIAL.println(sweep_duration(servo_info[i].sweep_speed, servo_info[i].sweep_next_step) * 10UL);
     }
   }
 }
 
 void servo_setup() {
-  SERVO_SERIAL.begin(SERVO_BAUDRATE);
+  link_begin(SERVO_SERIAL, LINK_SERVO, SERVO_BAUDRATE);
   pinMode(TAIL_COMM_ENABLE_PIN, OUTPUT);
   servo_maintain();
 }
 
+void servo_bus_service();
+
+// 試験モードの目標位置を受け付ける 未送信の値があれば上書きする
+void servo_test_post(uint8_t index, int16_t value) {
+  if (servo_info[index].test_pending && servo_status[index].test_dropped < 0xFFFF) servo_status[index].test_dropped++;
+  servo_info[index].test_value = value;
+  servo_info[index].test_pending = true;
+}
+
+// サーボ INDEX I の操舵 (ピン・ID・電圧値範囲・反転は定数として展開される)
+template <uint8_t I> struct ServoControl {
+  static inline void run() {
+    constexpr StickBand band = aircraft[I].band[CONTROL_STICK];
+    constexpr uint8_t low = aircraft[I].reverse ? MAX : MIN;   // l_min 側の舵角
+    constexpr uint8_t high = aircraft[I].reverse ? MIN : MAX;  // h_max 側の舵角
+    ServoInfo &info = servo_info[I];
+    if (info.test_mode | info.sweep_mode) {
+      if (!info.test_mode || !info.test_pending) return;
+      info.test_pending = false;
+      info.val = info.test_value;
+      servo_move(aircraft[I].id, info.val, 100);
+      return;
+    }
+    int16_t control = link_analog_read(aircraft[I].pin);
+    info.control_value = control;
+    if (control < band.c_min)      info.val = map(control, band.l_min, band.c_min, info.val_threshold[low], info.val_threshold[NEU]);
+    else if (control > band.c_max) info.val = map(control, band.c_max, band.h_max, info.val_threshold[NEU], info.val_threshold[high]);
+    else                           info.val = info.val_threshold[NEU];
+    servo_move(aircraft[I].id, info.val, 20);
+  }
+};
+
 void servo_control_all() {
-  for (uint8_t i = 0; i < servo_count; i++) {
-    if (servo_info[i].test_mode || servo_info[i].sweep_mode) continue;
-    servo_info[i].control_value = analogRead(servo_info[i].controller_pin);
-    if (servo_info[i].control_value < servo_info[i].c_min)      servo_info[i].val = map(servo_info[i].control_value, servo_info[i].l_min, servo_info[i].c_min, servo_info[i].val_threshold[servo_info[i].adjusted_min], servo_info[i].val_threshold[NEU]);
-    else if (servo_info[i].control_value > servo_info[i].c_max) servo_info[i].val = map(servo_info[i].control_value, servo_info[i].c_max, servo_info[i].h_max, servo_info[i].val_threshold[NEU], servo_info[i].val_threshold[servo_info[i].adjusted_max]);
-    else                                                        servo_info[i].val = servo_info[i].val_threshold[NEU];
-    servo_move(servo_info[i].id, servo_info[i].val, 20);
+  link_poll();
+  ForEachServo<ServoControl>::run();
+  servo_bus_service();
+}
+
+// 定期読み出しブロック(アドレス30〜53)の読み出し要求パケットを組み立て、パケット長を返す
+uint8_t servo_build_request(uint8_t id) {
+  ServoInfoRequest::begin(servo_tx_packet, id);
+  return ServoInfoRequest::end(servo_tx_packet);
+}
+
+// servo_rx_packet に受信済みのリターンパケットのヘッダーとチェックサムを確認する
+bool servo_check_packet(uint8_t len) {
+  if ((servo_rx_packet[0] == SERVO_RX_HEADER_0) && (servo_rx_packet[1] == SERVO_RX_HEADER_1)) {
+    if (servo_rx_packet[SERVO_PKT_DATA + len] == checksum(servo_rx_packet, SERVO_PKT_DATA + len)) return true;
   }
+  return false;
 }
 
-void servo_request_data(uint8_t id, uint8_t address, uint8_t len) {
-  servo_tx_packet[0] = 0xFA; //Header
-  servo_tx_packet[1] = 0xAF; //Header
-  servo_tx_packet[2] = id;   //ID
-  servo_tx_packet[3] = 0x0F; //Flags
-  servo_tx_packet[4] = address; //Address
-  servo_tx_packet[5] = len;
-  servo_tx_packet[6] = 0x00; //Count
-  servo_tx_packet[7] = checksum(servo_tx_packet, 7); //sum
-
-  /*DEBUG_SERIAL.print("SENT: ");
-    for (uint8_t i = 0; i < 8; i++){
-    DEBUG_SERIAL.print(servo_tx_packet[i], HEX);
-    DEBUG_SERIAL.print(' ');
-    }
-    DEBUG_SERIAL.println();*/
-  for (uint8_t i = 0; SERVO_SERIAL.available() && i < 255; i++) SERVO_SERIAL.read();
-  transmit_packet(8);
+// 応答時間の平均と平均偏差を更新する (TCP の RTT 推定と同じ重み 1/8, 1/4)
+void servo_rtt_update(uint8_t index, uint32_t sample) {
+  if (sample > SERVO_TIMEOUT_MAX) sample = SERVO_TIMEOUT_MAX;
+  if (servo_status[index].rtt_mean == 0) {
+    servo_status[index].rtt_mean = sample;
+    servo_status[index].rtt_dev = sample / 2;
+    return;
+  }
+  int16_t err = (int16_t)sample - (int16_t)servo_status[index].rtt_mean;
+  servo_status[index].rtt_mean += err / 8;
+  servo_status[index].rtt_dev += ((err < 0 ? -err : err) - (int16_t)servo_status[index].rtt_dev) / 4;
+}
+
+// 返信の最初のバイトを待つ時間(us)
+// 返信が無かったら、次からは連続で返信が無かった回数だけ倍々に伸ばす (TCP の再送タイムアウトと同じ, SERVO_TIMEOUT_MAX まで)
+// 応答が推定値より遅くなったサーボも、待ち時間が伸びて返信を受けられれば推定値が追いつく
+uint32_t servo_reply_timeout(uint8_t index) {
+  if (servo_status[index].rtt_mean == 0) return SERVO_TIMEOUT_MAX;
+  uint32_t timeout = (uint32_t)servo_status[index].rtt_mean + 4UL * servo_status[index].rtt_dev + SERVO_BYTE_TIME;
+  timeout = max(timeout, SERVO_TIMEOUT_MIN) << min(servo_status[index].fail_count, SERVO_TIMEOUT_BACKOFF);
+  return min(timeout, SERVO_TIMEOUT_MAX);
 }
 
-bool servo_receive_data(uint8_t len) {
-  delayMicroseconds(150);
+bool servo_receive_data(uint8_t index, uint8_t len) {
   uint32_t wait_time;   // リターンパケット待ち用引数
-  // リターンパケットの最初のバイトが来るまで待つ(最大10ms)
+  // リターンパケットの最初のバイトが来るまで待つ(応答時間の推定値から決める)
   // そもそも返信が来ているか（接続されているか）をチェック
-  wait_time = millis();
-  while (!SERVO_SERIAL.available()) if (millis() - wait_time > 10UL) return false;
-  // リターンパケットの最初のバイトが0xFDになるまで待つ(最大25ms) // パケットズレ防止
+  uint32_t timeout = servo_reply_timeout(index);
+  wait_time = micros();
+  while (!link_available(SERVO_SERIAL, LINK_SERVO)) if ((uint32_t)(micros() - wait_time) > timeout) {
+      link_timeout(LINK_SERVO);
+      return false;
+    }
+  servo_rtt_update(index, micros() - wait_time);
+  // リターンパケットの最初のバイトが0xFDになるまで待つ // パケットズレ防止
   // リターンパケットが来ても、以前受信に失敗した分かも知れないのでヘッダーが来るまで流す
-  wait_time = millis();
-  while ((servo_rx_packet[0] = SERVO_SERIAL.read()) != 0xFD) if (millis() - wait_time > 25UL) return false;
-  delayMicroseconds(1050);
-  // 残りのバイトを読み取る
-  wait_time = millis();
-  for (uint8_t i = 1; i < 8 + len; i++) {
-    while (!SERVO_SERIAL.available()) if ((uint32_t)(millis() - wait_time) > 3UL) return false;
-    servo_rx_packet[i] = SERVO_SERIAL.read();
-    wait_time = millis();
-    delayMicroseconds(1010);
+  wait_time = micros();
+  while (true) {
+    if (link_available(SERVO_SERIAL, LINK_SERVO)) {
+      if ((servo_rx_packet[0] = link_read(SERVO_SERIAL, LINK_SERVO)) == SERVO_RX_HEADER_0) break;
+      link_discard(LINK_SERVO);
+      wait_time = micros();
+    }
+    else if ((uint32_t)(micros() - wait_time) > 2 * SERVO_BYTE_TIME) {
+      link_timeout(LINK_SERVO);
+      return false;
+    }
   }
-  if ((servo_rx_packet[0] == 0xFD) && (servo_rx_packet[1] == 0xDF)) {
-    if (servo_rx_packet[7 + len] == checksum(servo_rx_packet, 7 + len)) return true;
+  // 残りのバイトを読み取る (1バイトにつき最大2バイト分の時間待つ)
+  wait_time = micros();
+  for (uint8_t i = 1; i < servo_packet_len(len); i++) {
+    while (!link_available(SERVO_SERIAL, LINK_SERVO)) if ((uint32_t)(micros() - wait_time) > 2 * SERVO_BYTE_TIME) {
+        link_timeout(LINK_SERVO);
+        return false;
+      }
+    servo_rx_packet[i] = link_read(SERVO_SERIAL, LINK_SERVO);
+    wait_time = micros();
   }
-  return false;
+  bool ok = servo_check_packet(len);
+  link_frame(LINK_SERVO, ok);
+  return ok;
+}
+
+// ---------- 位置推定 ------------------------------------------------------------------------- //
+// 読み出しの間(REQUEST_COOLDOWN)のサーボ位置を、最後に読み出した現在位置から目標位置に向かって一定速度で進めて推定する
+// 速度は読み出した目標時間の残りで目標位置に着く速さ、目標時間を過ぎていれば読み出した現在速度とする
+// 向かう先は最後に送った目標位置(val)なので、読み出し後の操舵にも追従する (読み出すたびに起点を取り直す)
+
+#define ESTIMATE_AGE_MAX 10000UL // 推定の経過時間の上限(ms) これ以上は目標位置に着いたものとする
+
+// 読み出した現在位置 position・目標位置 goal・目標時間の残り remaining(10ms)・現在速度 speed から推定の起点と速度を取り直す
+void servo_estimate_correct(uint8_t index, int16_t position, int16_t goal, int16_t remaining, int16_t speed) {
+  int16_t distance = goal - position;
+  uint32_t rate;
+  if (remaining > 0) rate = (uint32_t)abs(distance) * 100 / remaining;
+  else               rate = (uint32_t)abs(speed) * 10;
+  servo_status[index].est_origin = position;
+  servo_status[index].est_rate = min(rate, 0xFFFFUL);
+  servo_status[index].est_time = millis();
+  servo_status[index].est_valid = true;
+}
+
+// 時刻 now(ms) の推定位置
+int16_t servo_estimate(uint8_t index, uint32_t now) {
+  if (!servo_status[index].est_valid) return servo_info[index].val;
+  uint32_t age = min(now - servo_status[index].est_time, ESTIMATE_AGE_MAX);
+  uint32_t travel = (uint32_t)servo_status[index].est_rate * age / 1000;
+  int16_t distance = servo_info[index].val - servo_status[index].est_origin;
+  if (travel >= (uint32_t)abs(distance)) return servo_info[index].val;
+  return distance > 0 ? servo_status[index].est_origin + (int16_t)travel : servo_status[index].est_origin - (int16_t)travel;
+}
+
+// 推定の起点にした読み出しからの経過時間(ms)
+uint16_t servo_estimate_age(uint8_t index, uint32_t now) {
+  if (!servo_status[index].est_valid) return SENSORY_AGE_NONE;
+  return min(now - servo_status[index].est_time, (uint32_t)(SENSORY_AGE_NONE - 1));
+}
+
+// servo_rx_packet の定期読み出しブロックの返信を計測基板用スロット slot と servo_status に展開する
+// 各フィールドは1回だけ読み、スロットに写しながらその値を servo_status と位置推定に使う
+void servo_decode_info(uint8_t index, uint8_t *slot) {
+  const uint8_t *rx = servo_rx_packet;
+  ServoStatus &status = servo_status[index];
+  uint8_t flags         = PacketMove<ServoInfoFlags,        SensorySlotFlags>::move(slot, rx);
+  int16_t goal          = PacketMove<ServoInfoGoalPosition, SensorySlotGoalPosition>::move(slot, rx);
+  uint16_t goal_time    = PacketMove<ServoInfoGoalTime,     SensorySlotGoalTime>::move(slot, rx);
+  status.torque_percentage  = PacketMove<ServoInfoMaxTorque,  SensorySlotMaxTorque>::move(slot, rx);
+  status.actual_torque_mode = PacketMove<ServoInfoTorqueMode, SensorySlotTorqueMode>::move(slot, rx);
+  int16_t position      = PacketMove<ServoInfoPosition,     SensorySlotPosition>::move(slot, rx);
+  uint16_t present_time = PacketMove<ServoInfoPresentTime,  SensorySlotPresentTime>::move(slot, rx);
+  int16_t speed         = PacketMove<ServoInfoSpeed,        SensorySlotSpeed>::move(slot, rx);
+  status.load           = PacketMove<ServoInfoLoad,         SensorySlotLoad>::move(slot, rx);
+  status.temperature    = PacketMove<ServoInfoTemperature,  SensorySlotTemperature>::move(slot, rx);
+  status.voltage        = PacketMove<ServoInfoVoltage,      SensorySlotVoltage>::move(slot, rx);
+  status.actual_position = position;
+  status.temp_limit       = (flags & SERVO_STATUS_TEMP_LIMIT) ? 1 : 0;
+  status.temp_limit_alarm = (flags & SERVO_STATUS_TEMP_LIMIT_ALARM) ? 1 : 0;
+  status.rom_write_error  = (flags & SERVO_STATUS_ROM_WRITE_ERROR) ? 1 : 0;
+  status.packet_error     = (flags & SERVO_STATUS_PACKET_ERROR) ? 1 : 0;
+  servo_estimate_correct(index, position, goal, (int16_t)(goal_time - present_time), speed);
 }
 
+// 状態の読み出し結果を反映する
+// 返信が無いサーボは読み出し間隔を倍々に伸ばし、他のサーボの操舵にバスを譲る
+// 返信が戻ったら間隔を元に戻し、すぐに次の読み出しを行って状態を取り直す
+// 1回返信を取りこぼしただけでは再起動しないよう、SERVO_LOST_FAILS 回続くまでは直前のトルクモードを残す
+void servo_receive_info(uint8_t index, uint8_t* packet, bool received) {
+  servo_status[index].torque_sync = false;
+  if (received) {
+    servo_decode_info(index, packet);
+    if (servo_status[index].fail_count > 0) {
+      servo_status[index].fail_count = 0;
+      servo_status[index].request_interval = REQUEST_COOLDOWN;
+      servo_status[index].last_request_time = millis() - REQUEST_COOLDOWN;
+    }
+  }
+  else {
+    if (servo_status[index].fail_count < 0xFF) servo_status[index].fail_count++;
+    if (servo_status[index].fail_count > 1) {
+      servo_status[index].request_interval = min(servo_status[index].request_interval * 2UL, REQUEST_BACKOFF_MAX);
+    }
+    if (servo_status[index].fail_count >= SERVO_LOST_FAILS) {
+      servo_status[index].actual_torque_mode = 0;
+      playAlert();
+    }
+  }
+  servo_health_sample(index, received);
+}
+
+// 状態の読み出しをバスに積む (返信は servo_bus_service() で packet と servo_info に展開される)
 void servo_pack_info(uint8_t id, uint8_t* packet) {
   uint8_t index;
   if ((index = get_index(id)) == 0xFF) return;
-  if ((uint32_t)(millis() - servo_info[index].last_request_time) < REQUEST_COOLDOWN) return;
-  servo_request_data(servo_info[index].id, 30, 24);
-  if (servo_receive_data(24)) {
-    packet[0 ] = servo_tx_packet[3];    // flag
-    packet[1 ] = servo_rx_packet[7];    // goal position L
-    packet[2 ] = servo_rx_packet[8];    // goal position H
-    packet[3 ] = servo_rx_packet[9];    // goal time L
-    packet[4 ] = servo_rx_packet[10];   // goal time H
-    packet[5 ] = servo_rx_packet[12];   // max torque
-    packet[6 ] = servo_rx_packet[13];   // torque mode
-    packet[7 ] = servo_rx_packet[19];   // present position L
-    packet[8 ] = servo_rx_packet[20];   // present position H
-    packet[9 ] = servo_rx_packet[21];   // present time L
-    packet[10] = servo_rx_packet[22];   // present time H
-    packet[11] = servo_rx_packet[23];   // present speed L
-    packet[12] = servo_rx_packet[24];   // present speed H
-    packet[13] = servo_rx_packet[25];   // present load L
-    packet[14] = servo_rx_packet[26];   // present load H
-    packet[15] = servo_rx_packet[27];   // present temperature L
-    packet[16] = servo_rx_packet[28];   // present temperature H
-    packet[17] = servo_rx_packet[29];   // present voltage L
-    packet[18] = servo_rx_packet[30];   // present voltage H
-    servo_info[index].temp_limit          = (servo_rx_packet[3] & B10000000) >> 7;
-    servo_info[index].temp_limit_alarm    = (servo_rx_packet[3] & B00100000) >> 5;
-    servo_info[index].rom_write_error     = (servo_rx_packet[3] & B00001000) >> 3;
-    servo_info[index].packet_error        = (servo_rx_packet[3] & B00000010) >> 1;
-    servo_info[index].actual_torque_mode  = servo_rx_packet[13];
-    servo_info[index].torque_percentage   = servo_rx_packet[12];
-    servo_info[index].actual_position     = ((uint16_t)servo_rx_packet[20] << 8) | (uint16_t)servo_rx_packet[19];
-    servo_info[index].load                = ((uint16_t)servo_rx_packet[26] << 8) | (uint16_t)servo_rx_packet[25];
-    servo_info[index].temperature         = ((uint16_t)servo_rx_packet[28] << 8) | (uint16_t)servo_rx_packet[27];
-    servo_info[index].voltage             = ((uint16_t)servo_rx_packet[30] << 8) | (uint16_t)servo_rx_packet[29];
+  if ((uint32_t)(millis() - servo_status[index].last_request_time) < servo_status[index].request_interval) return;
+  if (servo_bus_pending(BUS_TELEMETRY, id)) return;
+  if (servo_bus_submit(BUS_TELEMETRY, servo_build_request(id), 0, SERVO_INFO_LEN, index, packet)) servo_status[index].last_request_time = millis();
+}
+
+// 積まれたパケットを優先度順に送信する
+// 状態の読み出しは返信待ちで時間がかかるため、1回の呼び出しにつき1つまでにする
+void servo_bus_service() {
+  bool telemetry_done = false;
+  while (true) {
+    if ((uint32_t)(millis() - bus_quiet_begin) < bus_quiet_time) return;
+    BusSlot *slot = NULL;
+    for (uint8_t i = 0; i < BUS_SLOTS; i++) {
+      if (!bus_slot[i].pending) continue;
+      if (slot == NULL || bus_slot[i].priority < slot->priority
+          || (bus_slot[i].priority == slot->priority && (int8_t)(bus_slot[i].order - slot->order) < 0)) slot = &bus_slot[i];
+    }
+    if (slot == NULL) return;
+    if (slot->priority == BUS_TELEMETRY && telemetry_done) return;
+
+    uint8_t priority = slot->priority;
+    uint32_t begin_time = micros();
+    if ((uint32_t)(begin_time - slot->submit_time) > bus_stats.wait_max[priority]) bus_stats.wait_max[priority] = begin_time - slot->submit_time;
+    if (slot->reply_len) {
+      // 以前受信に失敗した分が残っていれば流す
+      for (uint8_t i = 0; link_available(SERVO_SERIAL, LINK_SERVO) && i < 255; i++) {
+        link_read(SERVO_SERIAL, LINK_SERVO);
+        link_discard(LINK_SERVO);
+      }
+    }
+    transmit_packet(slot->packet, slot->len);
+    slot->pending = false;
+    if (slot->packet[SERVO_PKT_FLAGS] == SERVO_FLAG_REBOOT) servo_health_reboot(slot->index);
+    if (slot->quiet_time) {
+      bus_quiet_begin = millis();
+      bus_quiet_time = slot->quiet_time;
+    }
+    if (slot->reply_len) {
+      servo_receive_info(slot->index, slot->reply_packet, servo_receive_data(slot->index, slot->reply_len));
+      telemetry_done = true;
+    }
+    bus_stats.busy_time[priority] += micros() - begin_time;
   }
-  else {
-    servo_info[index].actual_torque_mode = 0;
-    playAlert();
+}
+
+// クラスごとの使用率(0.1%)
+uint16_t bus_utilization(const BusStats &stats, uint8_t c) {
+  if (stats.window == 0) return 0;
+  return min((uint64_t)stats.busy_time[c] * 1000 / stats.window, 1000ULL);
+}
+
+// クラス別のバス使用率と最大待ち時間を出力し、集計を bus_last に移してリセットする
+// 集計区間を区切る (DEBUG_COOLDOWN ごと)
+void servo_bus_window() {
+  bus_stats.window = micros() - bus_window_begin;
+  bus_window_begin = micros();
+  bus_last = bus_stats;
+  memset(&bus_stats, 0, sizeof(bus_stats));
+}
+
+// 直前の集計区間のバス使用状況を REQ_BUS の応答(DCM_BUS)のデータ部 data に書き込む
+void servo_bus_put(uint8_t *data) {
+  static_assert(BUS_CLASSES * BUS_STAT_LEN + BUS_STATS == BUS_DATA_LEN, "DCM_BUS must carry one BUS_STAT_* block per bus class");
+  PacketField<uint16_t, BUS_WINDOW>::put(data, min(bus_last.window / 1000, 0xFFFFUL));
+  for (uint8_t c = 0; c < BUS_CLASSES; c++) {
+    uint8_t *stat = data + BUS_STATS + c * BUS_STAT_LEN;
+    PacketField<uint16_t, BUS_STAT_UTIL>::put(stat, bus_utilization(bus_last, c));
+    PacketField<uint32_t, BUS_STAT_WAIT>::put(stat, bus_last.wait_max[c]);
+    PacketField<uint16_t, BUS_STAT_DROPPED>::put(stat, bus_last.dropped[c]);
   }
 }
 
+// デバッグ出力は 9600bps で送信バッファ(64byte)が空くのを待つと操舵が止まるので、1回の出力を短くする
+// バス・各系統の使用状況は ESP から CMD_REQ (REQ_BUS / REQ_LNK) で読み出す
 void print_debug_info() {
   if (millis() - last_debug_time < DEBUG_COOLDOWN) return;
+  servo_bus_window();
+  last_debug_time = millis();
+  if (millis() - last_memory_time >= DEBUG_MEMORY_COOLDOWN) { // 舵面の行の代わりに出力する
+    memory_report();
+    last_memory_time = millis();
+    return;
+  }
   for (uint8_t i = 0; i < servo_count; i++) {
-    //if (i == 0)
-    DEBUG_SERIAL.println(servo_info[i].alias + F("\t") + String(servo_info[i].control_value)
-                         + F("\t") + String(servo_info[i].val)
-                         + F("\t") + String(servo_info[i].actual_position) + "\t" + String(servo_info[i].load)
-                         + F("\t") + String(servo_info[i].temperature) + "\t" + String(servo_info[i].voltage)
-                         + F("\t") + String(servo_info[i].actual_torque_mode));
+    DEBUG_SERIAL.print(servo_info[i].alias);
+    DEBUG_SERIAL.print(F("\t"));
+    DEBUG_SERIAL.print(servo_info[i].val);
+    DEBUG_SERIAL.print(F("\t"));
+    DEBUG_SERIAL.print(servo_status[i].actual_position);
+    DEBUG_SERIAL.print(F("\t"));
+    DEBUG_SERIAL.println(servo_status[i].actual_torque_mode);
   }
-  last_debug_time = millis();
 }
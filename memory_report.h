@@ -0,0 +1,65 @@
+/*
+   RAM 使用量の確認
+   起動直後(.init1)に静的変数の末尾からスタックの底までを MEMORY_PAINT で塗っておき、
+   塗られたまま残っている量からスタックの最大使用量(ハイウォーターマーク)を求める
+   モジュール別の静的 RAM / フラッシュ使用量は tools/memory_report.sh で確認する
+*/
+
+#define MEMORY_PAINT 0xA5
+
+#ifdef __AVR__
+
+extern uint8_t _end;        // 静的変数(.data + .bss)の末尾
+extern uint8_t __stack;     // スタックの底 (RAMEND)
+extern uint8_t __data_start;
+
+void memory_paint() __attribute__((naked, used, section(".init1")));
+void memory_paint() {
+  uint8_t *p = &_end;
+  while (p <= &__stack) {
+    *p = MEMORY_PAINT;
+    p++;
+  }
+}
+
+// 静的変数の大きさ(byte)
+uint16_t memory_static() {
+  return (uint16_t)(&_end - &__data_start);
+}
+
+// 起動してからのスタックの最大使用量(byte)
+uint16_t memory_stack_peak() {
+  const uint8_t *p = &_end;
+  while (p <= &__stack && *p == MEMORY_PAINT) p++;
+  return (uint16_t)(&__stack - p + 1);
+}
+
+// 静的変数の末尾からスタックの最大到達点までの空き(byte)
+uint16_t memory_headroom() {
+  return (uint16_t)(&__stack - &_end + 1) - memory_stack_peak();
+}
+
+#else
+
+uint16_t memory_static() {
+  return 0;
+}
+
+uint16_t memory_stack_peak() {
+  return 0;
+}
+
+uint16_t memory_headroom() {
+  return 0;
+}
+
+#endif
+
+void memory_report() {
+  DEBUG_SERIAL.print(F("MEM\t"));
+  DEBUG_SERIAL.print(memory_static());
+  DEBUG_SERIAL.print(F("\t"));
+  DEBUG_SERIAL.print(memory_stack_peak());
+  DEBUG_SERIAL.print(F("\t"));
+  DEBUG_SERIAL.println(memory_headroom());
+}
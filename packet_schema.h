@@ -0,0 +1,381 @@
+/*
+   パケット構造定義
+   サーボ(Futaba コマンド型)、ESP、計測基板の各パケットのヘッダー・フィールド位置・コマンド番号をまとめたもの
+   各フィールドはテンプレートで位置を固定しているため、読み書きはすべて定数オフセットのバイトアクセスに展開される
+   Arduino に依存しないので、地上局側のツールからもそのままインクルードできる
+*/
+
+#ifndef PACKET_SCHEMA_H
+#define PACKET_SCHEMA_H
+
+#include <stdint.h>
+
+// ---------- 共通 ------------------------------------------------------------------------------ //
+
+// ID(3バイト目) から DATA の末尾までの各バイトのXOR
+inline uint8_t checksum(const uint8_t * data, uint8_t len) {
+  uint8_t sum = 0;
+  for (uint8_t i = 2; i < len; i++) sum ^= data[i];
+  return sum;
+}
+
+// パケット内の OFFSET の位置にあるフィールド (多バイトはリトルエンディアン)
+template <typename T, uint8_t OFFSET> struct PacketField;
+
+template <uint8_t OFFSET> struct PacketField<uint8_t, OFFSET> {
+  enum { offset = OFFSET, size = 1 };
+  static inline uint8_t get(const uint8_t *p) {
+    return p[OFFSET];
+  }
+  static inline void put(uint8_t *p, uint8_t v) {
+    p[OFFSET] = v;
+  }
+};
+
+template <uint8_t OFFSET> struct PacketField<uint16_t, OFFSET> {
+  enum { offset = OFFSET, size = 2 };
+  static inline uint16_t get(const uint8_t *p) {
+    return ((uint16_t)p[OFFSET + 1] << 8) | (uint16_t)p[OFFSET];
+  }
+  static inline void put(uint8_t *p, uint16_t v) {
+    p[OFFSET] = (uint8_t)(v & 0x00FF);
+    p[OFFSET + 1] = (uint8_t)(v >> 8);
+  }
+};
+
+template <uint8_t OFFSET> struct PacketField<int16_t, OFFSET> {
+  enum { offset = OFFSET, size = 2 };
+  static inline int16_t get(const uint8_t *p) {
+    return (int16_t)PacketField<uint16_t, OFFSET>::get(p);
+  }
+  static inline void put(uint8_t *p, int16_t v) {
+    PacketField<uint16_t, OFFSET>::put(p, (uint16_t)v);
+  }
+};
+
+template <uint8_t OFFSET> struct PacketField<uint32_t, OFFSET> {
+  enum { offset = OFFSET, size = 4 };
+  static inline uint32_t get(const uint8_t *p) {
+    return ((uint32_t)PacketField<uint16_t, OFFSET + 2>::get(p) << 16) | PacketField<uint16_t, OFFSET>::get(p);
+  }
+  static inline void put(uint8_t *p, uint32_t v) {
+    PacketField<uint16_t, OFFSET>::put(p, (uint16_t)v);
+    PacketField<uint16_t, OFFSET + 2>::put(p, (uint16_t)(v >> 16));
+  }
+};
+
+// src の SRC フィールドを dst の DST フィールドに写し、その値を返す (src は1回だけ読む)
+// 受信パケットを別のパケットに転送しながら値も使うときに、同じバイトを読み直さないようにする
+template <typename SRC, typename DST> struct PacketMove {
+  static inline auto move(uint8_t *dst, const uint8_t *src) -> decltype(SRC::get(src)) {
+    auto v = SRC::get(src);
+    DST::put(dst, v);
+    return v;
+  }
+};
+
+// ---------- サーボ (Futaba コマンド型 RS485) ---------------------------------------------------- //
+
+#define SERVO_TX_HEADER_0 0xFA
+#define SERVO_TX_HEADER_1 0xAF
+#define SERVO_RX_HEADER_0 0xFD
+#define SERVO_RX_HEADER_1 0xDF
+
+// 送受信パケット共通の各バイト位置
+#define SERVO_PKT_ID      2
+#define SERVO_PKT_FLAGS   3
+#define SERVO_PKT_ADDRESS 4
+#define SERVO_PKT_LENGTH  5
+#define SERVO_PKT_COUNT   6
+#define SERVO_PKT_DATA    7
+
+// データ長 data_len のパケット全体の長さ (ヘッダー〜チェックサム)
+constexpr uint8_t servo_packet_len(uint8_t data_len) {
+  return SERVO_PKT_DATA + data_len + 1;
+}
+
+// 送信パケットのフラグ
+#define SERVO_FLAG_WRITE      0x00 // メモリマップ書き込み
+#define SERVO_FLAG_READ       0x0F // 指定アドレスからの読み出し
+#define SERVO_FLAG_REBOOT     0x20 // 再起動
+
+// リターンパケットのフラグ(ステータス)
+#define SERVO_STATUS_TEMP_LIMIT       0x80 // 温度リミット
+#define SERVO_STATUS_TEMP_LIMIT_ALARM 0x20 // 温度アラーム
+#define SERVO_STATUS_ROM_WRITE_ERROR  0x08 // ROM書き込みエラー
+#define SERVO_STATUS_PACKET_ERROR     0x02 // 受信パケットエラー
+
+// メモリマップ(RAM領域)のアドレス
+#define SERVO_ADDR_GOAL_POSITION        0x1E // 30 目標位置         2 byte
+#define SERVO_ADDR_GOAL_TIME            0x20 // 32 目標時間         2 byte
+#define SERVO_ADDR_MAX_TORQUE           0x23 // 35 最大トルク(%)    1 byte
+#define SERVO_ADDR_TORQUE_ENABLE        0x24 // 36 トルクモード     1 byte
+#define SERVO_ADDR_PRESENT_POSITION     0x2A // 42 現在位置         2 byte
+#define SERVO_ADDR_PRESENT_TIME         0x2C // 44 現在時間         2 byte
+#define SERVO_ADDR_PRESENT_SPEED        0x2E // 46 現在速度         2 byte
+#define SERVO_ADDR_PRESENT_CURRENT      0x30 // 48 現在負荷         2 byte
+#define SERVO_ADDR_PRESENT_TEMPERATURE  0x32 // 50 現在温度         2 byte
+#define SERVO_ADDR_PRESENT_VOLTAGE      0x34 // 52 現在電圧         2 byte
+#define SERVO_ADDR_REBOOT               0xFF
+
+// 定期的に読み出すブロック (アドレス30〜53)
+#define SERVO_INFO_ADDRESS SERVO_ADDR_GOAL_POSITION
+#define SERVO_INFO_LEN     24
+
+// 書き込みパケット (アドレス ADDRESS から LEN バイト、サーボ1台分)
+template <uint8_t FLAGS, uint8_t ADDRESS, uint8_t LEN, uint8_t COUNT> struct ServoPacket {
+  enum { length = servo_packet_len(LEN * COUNT) };
+  // ヘッダーを書き込み、データ部の先頭を返す
+  static inline uint8_t *begin(uint8_t *p, uint8_t id) {
+    p[0] = SERVO_TX_HEADER_0;
+    p[1] = SERVO_TX_HEADER_1;
+    p[SERVO_PKT_ID] = id;
+    p[SERVO_PKT_FLAGS] = FLAGS;
+    p[SERVO_PKT_ADDRESS] = ADDRESS;
+    p[SERVO_PKT_LENGTH] = LEN;
+    p[SERVO_PKT_COUNT] = COUNT;
+    return p + SERVO_PKT_DATA;
+  }
+  // チェックサムを付け、パケット長を返す
+  static inline uint8_t end(uint8_t *p) {
+    p[length - 1] = checksum(p, length - 1);
+    return length;
+  }
+};
+
+typedef ServoPacket<SERVO_FLAG_WRITE, SERVO_ADDR_GOAL_POSITION, 4, 1>   ServoMovePacket;        // 目標位置・目標時間
+typedef ServoPacket<SERVO_FLAG_WRITE, SERVO_ADDR_MAX_TORQUE, 1, 1>      ServoTorqueValuePacket; // 最大トルク(%)
+typedef ServoPacket<SERVO_FLAG_WRITE, SERVO_ADDR_TORQUE_ENABLE, 1, 1>   ServoTorqueModePacket;  // トルクモード
+typedef ServoPacket<SERVO_FLAG_REBOOT, SERVO_ADDR_REBOOT, 0, 0>         ServoRebootPacket;      // 再起動
+
+// ServoMovePacket のデータ部
+typedef PacketField<uint16_t, 0> ServoMoveAngle;
+typedef PacketField<uint16_t, 2> ServoMoveTime;
+
+// 読み出し要求パケット (LENGTH に読み出すバイト数を入れる)
+template <uint8_t ADDRESS, uint8_t LEN> struct ServoReadPacket : ServoPacket<SERVO_FLAG_READ, ADDRESS, 0, 0> {
+  static inline uint8_t *begin(uint8_t *p, uint8_t id) {
+    uint8_t *data = ServoPacket<SERVO_FLAG_READ, ADDRESS, 0, 0>::begin(p, id);
+    p[SERVO_PKT_LENGTH] = LEN;
+    return data;
+  }
+};
+
+typedef ServoReadPacket<SERVO_INFO_ADDRESS, SERVO_INFO_LEN> ServoInfoRequest;
+
+// 定期読み出しブロックのリターンパケット上のフィールド
+template <typename T, uint8_t ADDRESS> struct ServoInfoField : PacketField<T, SERVO_PKT_DATA + ADDRESS - SERVO_INFO_ADDRESS> {};
+
+#define SERVO_INFO_REPLY_LEN servo_packet_len(SERVO_INFO_LEN)
+
+typedef PacketField<uint8_t, SERVO_PKT_FLAGS>                                 ServoInfoFlags;
+typedef ServoInfoField<int16_t, SERVO_ADDR_GOAL_POSITION>                     ServoInfoGoalPosition;
+typedef ServoInfoField<uint16_t, SERVO_ADDR_GOAL_TIME>                        ServoInfoGoalTime;
+typedef ServoInfoField<uint8_t, SERVO_ADDR_MAX_TORQUE>                        ServoInfoMaxTorque;
+typedef ServoInfoField<uint8_t, SERVO_ADDR_TORQUE_ENABLE>                     ServoInfoTorqueMode;
+typedef ServoInfoField<int16_t, SERVO_ADDR_PRESENT_POSITION>                  ServoInfoPosition;
+typedef ServoInfoField<uint16_t, SERVO_ADDR_PRESENT_TIME>                     ServoInfoPresentTime;
+typedef ServoInfoField<int16_t, SERVO_ADDR_PRESENT_SPEED>                     ServoInfoSpeed;
+typedef ServoInfoField<int16_t, SERVO_ADDR_PRESENT_CURRENT>                   ServoInfoLoad;
+typedef ServoInfoField<int16_t, SERVO_ADDR_PRESENT_TEMPERATURE>               ServoInfoTemperature;
+typedef ServoInfoField<int16_t, SERVO_ADDR_PRESENT_VOLTAGE>                   ServoInfoVoltage;
+
+// ---------- 計測基板 -------------------------------------------------------------------------- //
+
+#define SENSORY_HEADER_0 0x7C
+#define SENSORY_HEADER_1 0xC7
+
+#define SENSORY_PKT_LENGTH 2
+#define SENSORY_PKT_DATA   3
+
+// サーボ1台分のスロット (データ部に ID 順に並ぶ)
+// 推定現在位置・経過時間を加えてスロットは 19 byte から 23 byte になった (先頭 19 byte の並びは同じ)
+// 版を表すバイトは持たず、LENGTH (旧 38, 新 46) で見分ける 計測基板側は LENGTH / SENSORY_SLOT_COUNT をスロット長として読むこと
+#define SENSORY_SLOT_FLAGS    0  // サーボのステータスフラグ (リターンパケットの FLAGS) 1 byte
+                                 // 以前は読み出し要求の送信フラグ(常に 0x0F)が入っていたので、計測基板側は読み替えること
+#define SENSORY_SLOT_GOAL     1  // 目標位置, 目標時間 4 byte
+#define SENSORY_SLOT_TORQUE   5  // 最大トルク, トルクモード 2 byte
+#define SENSORY_SLOT_PRESENT  7  // 現在位置, 時間, 速度, 負荷, 温度, 電圧 12 byte
+#define SENSORY_SLOT_ESTIMATE 19 // 推定現在位置      2 byte
+#define SENSORY_SLOT_AGE      21 // 推定の起点にした読み出しからの経過時間(ms) 2 byte 0xFFFF: 未読み出し
+#define SENSORY_SLOT_LEN      23
+
+#define SENSORY_SLOT_COUNT 2
+#define SENSORY_DATA_LEN   (SENSORY_SLOT_LEN * SENSORY_SLOT_COUNT)
+#define SENSORY_PACKET_LEN (SENSORY_PKT_DATA + SENSORY_DATA_LEN + 1)
+
+// スロット内の各フィールド (GOAL, TORQUE, PRESENT はサーボのメモリマップの並びのまま)
+template <typename T, uint8_t BLOCK, uint8_t BLOCK_ADDRESS, uint8_t ADDRESS> struct SensorySlotField : PacketField<T, BLOCK + ADDRESS - BLOCK_ADDRESS> {};
+
+typedef PacketField<uint8_t, SENSORY_SLOT_FLAGS>                                                                    SensorySlotFlags;
+typedef SensorySlotField<int16_t,  SENSORY_SLOT_GOAL,    SERVO_ADDR_GOAL_POSITION,    SERVO_ADDR_GOAL_POSITION>      SensorySlotGoalPosition;
+typedef SensorySlotField<uint16_t, SENSORY_SLOT_GOAL,    SERVO_ADDR_GOAL_POSITION,    SERVO_ADDR_GOAL_TIME>          SensorySlotGoalTime;
+typedef SensorySlotField<uint8_t,  SENSORY_SLOT_TORQUE,  SERVO_ADDR_MAX_TORQUE,       SERVO_ADDR_MAX_TORQUE>         SensorySlotMaxTorque;
+typedef SensorySlotField<uint8_t,  SENSORY_SLOT_TORQUE,  SERVO_ADDR_MAX_TORQUE,       SERVO_ADDR_TORQUE_ENABLE>      SensorySlotTorqueMode;
+typedef SensorySlotField<int16_t,  SENSORY_SLOT_PRESENT, SERVO_ADDR_PRESENT_POSITION, SERVO_ADDR_PRESENT_POSITION>   SensorySlotPosition;
+typedef SensorySlotField<uint16_t, SENSORY_SLOT_PRESENT, SERVO_ADDR_PRESENT_POSITION, SERVO_ADDR_PRESENT_TIME>       SensorySlotPresentTime;
+typedef SensorySlotField<int16_t,  SENSORY_SLOT_PRESENT, SERVO_ADDR_PRESENT_POSITION, SERVO_ADDR_PRESENT_SPEED>      SensorySlotSpeed;
+typedef SensorySlotField<int16_t,  SENSORY_SLOT_PRESENT, SERVO_ADDR_PRESENT_POSITION, SERVO_ADDR_PRESENT_CURRENT>    SensorySlotLoad;
+typedef SensorySlotField<int16_t,  SENSORY_SLOT_PRESENT, SERVO_ADDR_PRESENT_POSITION, SERVO_ADDR_PRESENT_TEMPERATURE> SensorySlotTemperature;
+typedef SensorySlotField<int16_t,  SENSORY_SLOT_PRESENT, SERVO_ADDR_PRESENT_POSITION, SERVO_ADDR_PRESENT_VOLTAGE>    SensorySlotVoltage;
+typedef PacketField<int16_t, SENSORY_SLOT_ESTIMATE>                                                                 SensorySlotEstimate;
+typedef PacketField<uint16_t, SENSORY_SLOT_AGE>                                                                     SensorySlotAge;
+
+#define SENSORY_AGE_NONE 0xFFFF
+
+// ---------- ESP ------------------------------------------------------------------------------- //
+
+#define ESP_RX_HEADER_0 0x8F // ESP → 操舵基板
+#define ESP_RX_HEADER_1 0xF8
+#define ESP_TX_HEADER_0 0x8D // 操舵基板 → ESP
+#define ESP_TX_HEADER_1 0xD8
+
+#define ESP_PKT_DEVICE  2
+#define ESP_PKT_COMMAND 3
+#define ESP_PKT_LENGTH  4
+#define ESP_PKT_DATA    5
+
+// データ長 data_len のパケット全体の長さ (ヘッダー〜チェックサム)
+constexpr uint8_t esp_packet_len(uint8_t data_len) {
+  return ESP_PKT_DATA + data_len + 1;
+}
+
+// 操舵基板 → ESP のパケット (データ長 LEN)
+template <uint8_t LEN> struct EspPacket {
+  enum { length = esp_packet_len(LEN) };
+  // ヘッダーを書き込み、データ部の先頭を返す
+  static inline uint8_t *begin(uint8_t *p, uint8_t device, uint8_t command) {
+    p[0] = ESP_TX_HEADER_0;
+    p[1] = ESP_TX_HEADER_1;
+    p[ESP_PKT_DEVICE] = device;
+    p[ESP_PKT_COMMAND] = command;
+    p[ESP_PKT_LENGTH] = LEN;
+    return p + ESP_PKT_DATA;
+  }
+  // チェックサムを付け、パケット長を返す
+  static inline uint8_t end(uint8_t *p) {
+    p[length - 1] = checksum(p, length - 1);
+    return length;
+  }
+};
+
+// 操舵基板 → ESP のパケット (データ長が実行時に決まるもの)
+// ヘッダーを書き込み、データ部の先頭を返す
+inline uint8_t *esp_packet_begin(uint8_t *p, uint8_t device, uint8_t command) {
+  p[0] = ESP_TX_HEADER_0;
+  p[1] = ESP_TX_HEADER_1;
+  p[ESP_PKT_DEVICE] = device;
+  p[ESP_PKT_COMMAND] = command;
+  return p + ESP_PKT_DATA;
+}
+
+// データ長とチェックサムを付け、パケット長を返す
+inline uint8_t esp_packet_end(uint8_t *p, uint8_t data_len) {
+  uint8_t length = esp_packet_len(data_len);
+  p[ESP_PKT_LENGTH] = data_len;
+  p[length - 1] = checksum(p, length - 1);
+  return length;
+}
+
+// ESP → 操舵基板 コマンド
+#define CMD_LOG 0x00
+#define CMD_SET 0x01
+#define CMD_REQ 0x02
+#define CMD_RBT 0x03
+#define CMD_TQS 0x04
+#define CMD_TMS 0x05
+#define CMD_TMD 0x06
+#define CMD_TMV 0x07
+#define CMD_SWP 0x08
+#define CMD_PRP 0xF0
+
+// CMD_PRP (確認パケット DCM_PRP への応答) のデータ部
+#define PRP_COMMAND  0 // 確認したコマンドの種類 (CMD_*) 1 byte
+#define PRP_ACCEPT   1 // 0x01: 承認 それ以外: 拒否 1 byte
+#define PRP_DATA_LEN 2
+
+// CMD_SET の対象 (bit2: サーボID - 1, bit0-1: 1=MIN 2=NEU 3=MAX)
+#define SET_SERVO_SHIFT 2
+#define SET_SERVO_MASK  0x01
+#define SET_TYPE_MASK   0x03
+
+// サーボID id の舵角 type(0=MIN 1=NEU 2=MAX) の CMD_SET の対象
+constexpr uint8_t set_target(uint8_t id, uint8_t type) {
+  return (uint8_t)(((id - 1) << SET_SERVO_SHIFT) | (type + 1));
+}
+
+#define SET_RUD_MIN 0x01
+#define SET_RUD_NEU 0x02
+#define SET_RUD_MAX 0x03
+#define SET_ELE_MIN 0x05
+#define SET_ELE_NEU 0x06
+#define SET_ELE_MAX 0x07
+
+// CMD_REQ の要求内容
+#define REQ_INI 0x01 // 初期値 (DCM_DSP)
+#define REQ_HLT 0x02 // サーボの健康状態の統計 (DCM_HLT, サーボ1台につき1パケット)
+#define REQ_LNK 0x03 // 通信量・エラーの集計 (DCM_LNK, シリアル1系統につき1パケット)
+#define REQ_BUS 0x04 // サーボバスのクラス別使用状況 (DCM_BUS)
+
+// 操舵基板 → ESP コマンド
+#define DCM_DSP 0x00
+#define DCM_PRP 0x01
+#define DCM_HLT 0x02
+#define DCM_LNK 0x03
+#define DCM_BUS 0x04
+
+// 初期値送信(DCM_DSP)のデータ部 項目ごとにサーボID 1〜DSP_SERVOS の順に並べる
+//   舵角     CMD_SET の対象, 値 (MIN, NEU, MAX の順)  3 byte × 3
+//   テストモード DSP_TEST + サーボID - 1, 値         2 byte
+//   トルクモード DSP_TORQUE + サーボID - 1, 値       2 byte
+//   スイープ     DSP_SWEEP + サーボID - 1, 有効, 速度 3 byte
+#define DSP_SERVOS   2 // CMD_SET の bit2 で表せるサーボの数
+#define DSP_TEST     0x08
+#define DSP_TORQUE   0x0A
+#define DSP_SWEEP    0x0C
+#define DSP_DATA_LEN (DSP_SERVOS * (3 * 3 + 2 + 2 + 3))
+
+// 健康状態の統計(DCM_HLT)のデータ部
+#define HLT_ID           0  // サーボID                    1 byte
+#define HLT_LOAD         1  // 負荷(mA)の統計              8 byte
+#define HLT_TEMPERATURE  9  // 温度(℃)の統計               8 byte
+#define HLT_VOLTAGE      17 // 電圧(10mV)の統計            8 byte
+#define HLT_FAIL         25 // 読み出しに返信が無かった回数 2 byte
+#define HLT_REBOOT       27 // 再起動した回数              2 byte
+#define HLT_TEMP_LIMIT   29 // 温度リミットになった回数    1 byte
+#define HLT_TEMP_ALARM   30 // 温度アラームになった回数    1 byte
+#define HLT_PACKET_ERROR 31 // 受信パケットエラーの回数    1 byte
+#define HLT_DATA_LEN     32
+
+// 統計1項目 (HLT_LOAD, HLT_TEMPERATURE, HLT_VOLTAGE からの位置, 各 int16/uint16)
+#define HLT_STAT_MIN  0 // 最小値
+#define HLT_STAT_MAX  2 // 最大値
+#define HLT_STAT_EWMA 4 // 指数移動平均
+#define HLT_STAT_OVER 6 // しきい値を超えていた時間(s) 電圧は下回っていた時間
+#define HLT_STAT_LEN  8
+
+// 通信量・エラーの集計(DCM_LNK)のデータ部 (2バイト以上はリトルエンディアン)
+#define LNK_LINK           0  // 系統 (0: サーボ 1: ESP 2: 計測基板)    1 byte
+#define LNK_TX_UTIL        1  // 直近約2秒の送信の使用率(0.1%)           2 byte
+#define LNK_RX_UTIL        3  // 直近約2秒の受信の使用率(0.1%)           2 byte
+#define LNK_TX_BYTES       5  // 起動してからの送信バイト数              4 byte
+#define LNK_RX_BYTES       9  // 起動してからの受信バイト数              4 byte
+#define LNK_FRAMES_OK      13 // チェックサムが合った受信パケット数       2 byte
+#define LNK_CHECKSUM_FAIL  15 // チェックサム・長さが合わなかった受信パケット数 2 byte
+#define LNK_RESYNC_DISCARD 17 // ヘッダー待ちで捨てたバイト数            2 byte
+#define LNK_TIMEOUTS       19 // 受信途中・返信待ちのタイムアウト回数     2 byte
+#define LNK_FLUSH_TIME     21 // 送信完了待ちで止まっていた時間(ms)       4 byte
+#define LNK_DATA_LEN       25
+
+// サーボバスのクラス別使用状況(DCM_BUS)のデータ部 (直前の集計区間, 約200ms)
+#define BUS_WINDOW 0  // 集計区間の長さ(ms)                         2 byte
+#define BUS_STATS  2  // クラスごとの集計 (操舵, 保守, 読み出しの順) 8 byte × 3
+#define BUS_DATA_LEN (BUS_STATS + 3 * BUS_STAT_LEN)
+
+// クラスごとの集計 (BUS_STATS + クラス番号 × BUS_STAT_LEN からの位置)
+#define BUS_STAT_UTIL    0 // 送受信に使った時間の割合(0.1%)          2 byte
+#define BUS_STAT_WAIT    2 // 積んでから送信開始までの最大待ち時間(us) 4 byte
+#define BUS_STAT_DROPPED 6 // スロット不足で積めなかった回数          2 byte
+#define BUS_STAT_LEN     8
+
+#endif
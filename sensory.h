@@ -1,30 +1,49 @@
 #define SENSORY_SERIAL Serial3
 #define SENSORY_BAUDRATE 9600
 
-// 計測基板送信用パケット最大バイト数
-#define SENSORY_COMM_MAX_BYTES 64
 // 計測値送信用パケット
-uint8_t sensory_tx_packet[SENSORY_COMM_MAX_BYTES] = {0};
+uint8_t sensory_tx_packet[SENSORY_PACKET_LEN] = {0};
 
-uint16_t cooldown = 200;
+// 1フレームの送信時間(ms) 1byte = 10bit (9600bpsで約52ms)
+#define SENSORY_FRAME_TIME ((SENSORY_PACKET_LEN * 10UL * 1000 + SENSORY_BAUDRATE - 1) / SENSORY_BAUDRATE)
+
+// 送信間隔(ms) 1フレームの送信時間の2倍にして、回線の使用率を約50%に抑える
+uint16_t cooldown = SENSORY_FRAME_TIME * 2;
 uint32_t last_time = 0;
 
 void sensory_setup() {
-  SENSORY_SERIAL.begin(SENSORY_BAUDRATE);
+  link_begin(SENSORY_SERIAL, LINK_SENSORY, SENSORY_BAUDRATE);
 }
 
 uint8_t *sensory_packet(uint8_t id) {
-  return sensory_tx_packet + 3 + (id - 1) * 19;
+  return sensory_tx_packet + SENSORY_PKT_DATA + (id - 1) * SENSORY_SLOT_LEN;
+}
+
+// 計測基板送信用パケットのヘッダーとチェックサムを付け、パケット長を返す
+uint8_t sensory_build() {
+  sensory_tx_packet[0] = SENSORY_HEADER_0;
+  sensory_tx_packet[1] = SENSORY_HEADER_1;
+  sensory_tx_packet[SENSORY_PKT_LENGTH] = SENSORY_DATA_LEN;
+  sensory_tx_packet[SENSORY_PACKET_LEN - 1] = checksum(sensory_tx_packet, SENSORY_PACKET_LEN - 1);
+  return SENSORY_PACKET_LEN;
+}
+
+// 各スロットに送信時点の推定位置と経過時間を書き込む (読み出し値は servo_decode_info() で書き込み済み)
+void sensory_estimate() {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < servo_count; i++) {
+    uint8_t *slot = sensory_packet(servo_info[i].id);
+    SensorySlotEstimate::put(slot, servo_estimate(i, now));
+    SensorySlotAge::put(slot, servo_estimate_age(i, now));
+  }
 }
 
+// 操舵の合間ごとに呼び、送信間隔(cooldown)で送信頻度を決める
+// 送信間隔は1フレームの送信時間より長く、1フレームは送信バッファ(64byte)に収まるので flush() で待たない
 void sensory_transmit() {
   if ((uint32_t)(millis() - last_time) > cooldown) {
-    sensory_tx_packet[0] = 0x7C;
-    sensory_tx_packet[1] = 0xC7;
-    sensory_tx_packet[2] = 38;
-    sensory_tx_packet[41] = checksum(sensory_tx_packet, 41);
-    SENSORY_SERIAL.write(sensory_tx_packet, 42);
-    SENSORY_SERIAL.flush();
+    sensory_estimate();
+    link_write(SENSORY_SERIAL, LINK_SENSORY, sensory_tx_packet, sensory_build());
     last_time = millis();
   }
 }
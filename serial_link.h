@@ -0,0 +1,268 @@
+/*
+   シリアル通信の入出力
+   サーボ・ESP・計測基板との送受信と操縦桿の読み取りはすべてここを通す
+   SERIAL_CAPTURE を定義すると、送受信した全バイトと操縦桿の読み取り値を時刻付きで CAPTURE_SERIAL に出力する
+   (形式は trace_format.h、再生は tools/replay) 記録の先頭には再生時に読み込む EEPROM の内容を付ける
+   記録中は受信バッファを各処理の合間(link_available(), link_read(), link_poll())に系統ごとの受信待ちに移し、
+   取り出した時刻で記録する 受信待ちがあふれたら捨てたバイト数を、受信バッファが満杯だったらそのことを記録する
+   記録中は CAPTURE_SERIAL を記録に使うため、デバッグ出力は捨てられる
+   系統ごとに送受信バイト数・受信パケットの正常/異常・ヘッダー待ちで捨てたバイト数・タイムアウト・
+   flush() で止まっていた時間を数え、直近約2秒の使用率を求める (ESP からは CMD_REQ / REQ_LNK で読み出す)
+*/
+
+#include "trace_format.h"
+#include "packet_schema.h"
+
+#ifdef SERIAL_CAPTURE
+
+#include <EEPROM.h>
+
+#define CAPTURE_SERIAL Serial
+#define CAPTURE_BAUDRATE 500000 // 3系統 9600bps の記録が余裕を持って流れる速さ
+#define CAPTURE_EEPROM_LEN 256  // 記録の先頭に付ける EEPROM の範囲 (舵角・健康状態の統計)
+
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+#define CAPTURE_RX_SIZE (SERIAL_RX_BUFFER_SIZE - 1) // 系統ごとの受信待ち (HardwareSerial が溜められるのと同じだけにして、あふれ方を変えない)
+
+uint32_t capture_last_time = 0;
+
+HardwareSerial *capture_serial[LINKS] = {NULL};   // link_begin() した系統のシリアル
+uint8_t capture_rx[LINKS][CAPTURE_RX_SIZE];        // 取り出して記録済みで、ファームウェアがまだ読んでいないバイト
+uint8_t capture_rx_head[LINKS] = {0};
+uint8_t capture_rx_count[LINKS] = {0};
+
+void capture_setup() {
+  CAPTURE_SERIAL.begin(CAPTURE_BAUDRATE);
+  CAPTURE_SERIAL.write((const uint8_t *)TRACE_MAGIC, 4);
+  CAPTURE_SERIAL.write((uint8_t)TRACE_VERSION);
+  CAPTURE_SERIAL.write(lowByte(CAPTURE_EEPROM_LEN));
+  CAPTURE_SERIAL.write(highByte(CAPTURE_EEPROM_LEN));
+  for (uint16_t i = 0; i < CAPTURE_EEPROM_LEN; i++) CAPTURE_SERIAL.write(EEPROM.read(i));
+  capture_last_time = micros();
+}
+
+void capture_record(uint8_t link, uint8_t dir, const uint8_t *data, uint8_t len) {
+  while (len > 0) {
+    uint8_t run = len > TRACE_MAX_RUN ? TRACE_MAX_RUN : len;
+    uint32_t now = micros();
+    uint32_t elapsed = now - capture_last_time;
+    capture_last_time = now;
+    CAPTURE_SERIAL.write(trace_tag(link, dir, run));
+    while (elapsed >= 0x80) {
+      CAPTURE_SERIAL.write((uint8_t)(elapsed | 0x80));
+      elapsed >>= 7;
+    }
+    CAPTURE_SERIAL.write((uint8_t)elapsed);
+    CAPTURE_SERIAL.write(data, run);
+    data += run;
+    len -= run;
+  }
+}
+
+void capture_event(uint8_t event, uint8_t link, uint8_t count) {
+  uint8_t data[TRACE_EVENT_LEN] = {event, link, count};
+  capture_record(LINK_ANALOG, TRACE_EVENT, data, TRACE_EVENT_LEN);
+}
+
+// 系統 link の受信バッファに届いているバイトを取り出して記録し、受信待ちに移す
+void capture_drain(uint8_t link) {
+  HardwareSerial *serial = capture_serial[link];
+  if (serial == NULL) return;
+  int n = serial->available();
+  if (n <= 0) return;
+  if (n >= SERIAL_RX_BUFFER_SIZE - 1) capture_event(TRACE_EVENT_RX_FULL, link, 0);
+  uint8_t run[TRACE_MAX_RUN];
+  uint8_t len = 0;
+  uint8_t dropped = 0;
+  while (n-- > 0) {
+    uint8_t c = serial->read();
+    if (capture_rx_count[link] >= CAPTURE_RX_SIZE) {
+      if (dropped < 0xFF) dropped++;
+      continue;
+    }
+    capture_rx[link][(capture_rx_head[link] + capture_rx_count[link]) % CAPTURE_RX_SIZE] = c;
+    capture_rx_count[link]++;
+    run[len++] = c;
+    if (len == TRACE_MAX_RUN) {
+      capture_record(link, TRACE_RX, run, len);
+      len = 0;
+    }
+  }
+  if (len > 0) capture_record(link, TRACE_RX, run, len);
+  if (dropped > 0) capture_event(TRACE_EVENT_RX_DROPPED, link, dropped);
+}
+
+void capture_drain_all() {
+  for (uint8_t link = 0; link < LINKS; link++) capture_drain(link);
+}
+
+// 記録中のデバッグ出力先 (何も出力しない)
+class NullSerial : public Print {
+  public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t) {
+      return 1;
+    }
+};
+
+NullSerial debug_null;
+
+#endif
+
+// ---------- 通信量・エラーの集計 ------------------------------------------------------------- //
+
+#define LINK_BUCKET_SHIFT 8 // 使用率の集計区間 2^8 = 256ms
+#define LINK_BUCKETS      8 // 直近 8区間(約2秒)の合計から使用率を求める
+
+typedef struct LinkStats {
+  uint32_t baudrate;
+  uint32_t tx_bytes;
+  uint32_t rx_bytes;
+  uint16_t frames_ok;                // チェックサムが合った受信パケット数
+  uint16_t checksum_fail;            // ヘッダーは合ったがチェックサム・長さが合わなかった受信パケット数
+  uint16_t resync_discard;           // ヘッダー待ちで捨てたバイト数
+  uint16_t timeouts;                 // 受信途中・返信待ちのタイムアウト回数
+  uint32_t flush_time;               // flush() で送信完了を待っていた時間(ms)
+  uint16_t flush_us;                 // 同 1ms 未満の端数(us)
+  uint8_t bucket;                    // 最後に数えた区間の番号 (millis() >> LINK_BUCKET_SHIFT の下位8bit)
+  uint8_t tx_window[LINK_BUCKETS];   // 区間ごとの送信バイト数 (9600bps なら1区間最大245byte)
+  uint8_t rx_window[LINK_BUCKETS];   // 区間ごとの受信バイト数
+} LinkStats;
+
+LinkStats link_stats[LINKS];
+
+void link_begin(HardwareSerial &serial, uint8_t link, uint32_t baudrate) {
+  serial.begin(baudrate);
+#ifdef SERIAL_CAPTURE
+  capture_serial[link] = &serial;
+#endif
+  link_stats[link].baudrate = baudrate;
+  link_stats[link].bucket = (uint8_t)(millis() >> LINK_BUCKET_SHIFT);
+}
+
+// 今の区間まで進め、過ぎた区間を0にする
+void link_window_advance(LinkStats &stats) {
+  uint8_t bucket = (uint8_t)(millis() >> LINK_BUCKET_SHIFT);
+  uint8_t passed = bucket - stats.bucket;
+  if (passed == 0) return;
+  if (passed > LINK_BUCKETS) passed = LINK_BUCKETS;
+  for (uint8_t i = 1; i <= passed; i++) {
+    stats.tx_window[(uint8_t)(stats.bucket + i) % LINK_BUCKETS] = 0;
+    stats.rx_window[(uint8_t)(stats.bucket + i) % LINK_BUCKETS] = 0;
+  }
+  stats.bucket = bucket;
+}
+
+void link_window_add(uint8_t *window, uint8_t bucket, uint8_t len) {
+  uint8_t &count = window[bucket % LINK_BUCKETS];
+  count = (uint16_t)count + len > 0xFF ? 0xFF : count + len;
+}
+
+// 直近の使用率(0.1%) window: tx_window | rx_window
+uint16_t link_utilization(uint8_t link, const uint8_t *window) {
+  link_window_advance(link_stats[link]);
+  if (link_stats[link].baudrate == 0) return 0;
+  uint16_t bytes = 0;
+  for (uint8_t i = 0; i < LINK_BUCKETS; i++) bytes += window[i];
+  uint32_t window_ms = ((uint32_t)(LINK_BUCKETS - 1) << LINK_BUCKET_SHIFT) + (millis() & ((1UL << LINK_BUCKET_SHIFT) - 1));
+  uint32_t capacity = link_stats[link].baudrate * window_ms / 1000; // 区間内に送れるビット数
+  return (uint32_t)bytes * 10 * 1000 / capacity;
+}
+
+// 受信パケットの確認結果を数える
+void link_frame(uint8_t link, bool ok) {
+  if (ok) link_stats[link].frames_ok++;
+  else    link_stats[link].checksum_fail++;
+}
+
+void link_discard(uint8_t link) {
+  link_stats[link].resync_discard++;
+}
+
+void link_timeout(uint8_t link) {
+  link_stats[link].timeouts++;
+}
+
+// 送信完了を待ち、待った時間を数える
+void link_flush(HardwareSerial &serial, uint8_t link) {
+  uint32_t begin_time = micros();
+  serial.flush();
+  uint32_t elapsed = link_stats[link].flush_us + (micros() - begin_time);
+  link_stats[link].flush_time += elapsed / 1000;
+  link_stats[link].flush_us = elapsed % 1000;
+}
+
+// 系統 link の集計を REQ_LNK の応答(DCM_LNK)のデータ部 data に書き込む
+void link_stats_put(uint8_t *data, uint8_t link) {
+  const LinkStats &stats = link_stats[link];
+  data[LNK_LINK] = link;
+  PacketField<uint16_t, LNK_TX_UTIL>::put(data, link_utilization(link, stats.tx_window));
+  PacketField<uint16_t, LNK_RX_UTIL>::put(data, link_utilization(link, stats.rx_window));
+  PacketField<uint32_t, LNK_TX_BYTES>::put(data, stats.tx_bytes);
+  PacketField<uint32_t, LNK_RX_BYTES>::put(data, stats.rx_bytes);
+  PacketField<uint16_t, LNK_FRAMES_OK>::put(data, stats.frames_ok);
+  PacketField<uint16_t, LNK_CHECKSUM_FAIL>::put(data, stats.checksum_fail);
+  PacketField<uint16_t, LNK_RESYNC_DISCARD>::put(data, stats.resync_discard);
+  PacketField<uint16_t, LNK_TIMEOUTS>::put(data, stats.timeouts);
+  PacketField<uint32_t, LNK_FLUSH_TIME>::put(data, stats.flush_time);
+}
+
+// 記録中は全系統の受信バッファを取り出して記録する (受信した時刻に近い時刻で記録するため、処理の合間に呼ぶ)
+inline void link_poll() {
+#ifdef SERIAL_CAPTURE
+  capture_drain_all();
+#endif
+}
+
+int link_available(HardwareSerial &serial, uint8_t link) {
+#ifdef SERIAL_CAPTURE
+  (void)serial;
+  capture_drain_all();
+  return capture_rx_count[link];
+#else
+  (void)link;
+  return serial.available();
+#endif
+}
+
+int link_read(HardwareSerial &serial, uint8_t link) {
+#ifdef SERIAL_CAPTURE
+  (void)serial;
+  capture_drain_all();
+  int c = -1;
+  if (capture_rx_count[link] > 0) {
+    c = capture_rx[link][capture_rx_head[link]];
+    capture_rx_head[link] = (capture_rx_head[link] + 1) % CAPTURE_RX_SIZE;
+    capture_rx_count[link]--;
+  }
+#else
+  int c = serial.read();
+#endif
+  if (c >= 0) {
+    link_window_advance(link_stats[link]);
+    link_window_add(link_stats[link].rx_window, link_stats[link].bucket, 1);
+    link_stats[link].rx_bytes++;
+  }
+  return c;
+}
+
+void link_write(HardwareSerial &serial, uint8_t link, const uint8_t *data, uint8_t len) {
+  serial.write(data, len);
+  link_window_advance(link_stats[link]);
+  link_window_add(link_stats[link].tx_window, link_stats[link].bucket, len);
+  link_stats[link].tx_bytes += len;
+#ifdef SERIAL_CAPTURE
+  capture_record(link, TRACE_TX, data, len);
+#endif
+}
+
+int16_t link_analog_read(uint8_t pin) {
+  int16_t value = analogRead(pin);
+#ifdef SERIAL_CAPTURE
+  uint8_t data[TRACE_ANALOG_LEN] = {pin, lowByte(value), highByte(value)};
+  capture_record(LINK_ANALOG, TRACE_RX, data, TRACE_ANALOG_LEN);
+#endif
+  return value;
+}
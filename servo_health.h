@@ -0,0 +1,213 @@
+/*
+   サーボの健康状態の統計
+   定期読み出しのたびに負荷・温度・電圧の最小/最大・指数移動平均・しきい値を超えていた時間と、
+   返信なし・再起動・ステータスフラグの回数を更新する (1回の読み出しにつき定数時間)
+   統計は EEPROM に少しずつ書き戻し、リセット・電源断をまたいで積算を続ける
+   書き戻しは前回書き戻した内容から意味のある変化(最小/最大・回数・超過時間の変化、指数移動平均のしきい値以上の変化)が
+   あったときだけ、loop() の空き時間(servo_health_save())に行う 書き戻しの開始時に統計を写し取り、写しを書くので
+   途中で統計が更新されても EEPROM 上で新旧の値が混ざらない
+   ESP からは CMD_REQ / REQ_HLT で読み出す (esp_comm.h の command_send_health())
+*/
+
+// しきい値 (これを超えていた時間を積算する)
+#define HEALTH_LOAD_HIGH    1500 // 負荷(mA)
+#define HEALTH_TEMP_HIGH    60   // 温度(℃)
+#define HEALTH_VOLTAGE_LOW  650  // 電圧(10mV) 電圧はこれを下回っていた時間を積算する
+
+#define HEALTH_EWMA_SCALE   8    // 指数移動平均は8倍して持つ
+#define HEALTH_EWMA_WEIGHT  16   // 新しい値の重み 1/16
+#define HEALTH_SAMPLE_MAX   4000 // 統計に入れる値の範囲 (±, 8倍しても int16 に収まるように)
+#define HEALTH_INTERVAL_MAX 2000UL // 1回の読み出しで積算する時間の上限(ms)
+
+#define HEALTH_EEPROM_ADDR  0x10 // 0x00〜0x0B はサーボ角
+#define HEALTH_EEPROM_MAGIC 0x48 // HEALTH_EEPROM_ADDR に書く目印 (統計の形を変えたら変える)
+#define HEALTH_SAVE_INTERVAL 60000UL // EEPROM に書き戻す最短の間隔(ms)
+
+// 書き戻しのきっかけにする指数移動平均の変化 負荷(mA)・温度(℃)・電圧(10mV)
+const int16_t health_save_delta[3] = {50, 1, 10};
+
+typedef struct HealthStat {
+  int16_t min;
+  int16_t max;          // min > max: まだ値が無い
+  int16_t ewma;         // HEALTH_EWMA_SCALE 倍
+  uint16_t over_time;   // しきい値を超えていた時間(s)
+} HealthStat;
+
+// EEPROM にそのまま書き込む (reserved: 偶数サイズにするための予備)
+typedef struct ServoHealth {
+  HealthStat load;
+  HealthStat temperature;
+  HealthStat voltage;
+  uint16_t fail_count;
+  uint16_t reboot_count;
+  uint8_t temp_limit_count;
+  uint8_t temp_alarm_count;
+  uint8_t packet_error_count;
+  uint8_t reserved;
+} ServoHealth;
+
+ServoHealth servo_health[SERVO_COUNT_MAX];
+ServoHealth health_image[SERVO_COUNT_MAX]; // 書き戻し中・書き戻し済みの統計の写し
+
+#ifdef SERIAL_CAPTURE
+static_assert(HEALTH_EEPROM_ADDR + 1 + sizeof(servo_health) <= CAPTURE_EEPROM_LEN, "CAPTURE_EEPROM_LEN must cover the health statistics");
+#endif
+
+// EEPROM に書き戻さない途中経過
+uint16_t health_over_ms[SERVO_COUNT_MAX][3] = {{0}}; // 1秒未満の超過時間(ms) 負荷・温度・電圧
+uint8_t health_flags[SERVO_COUNT_MAX] = {0};        // 前回のリターンパケットのフラグ
+uint32_t health_sample_time[SERVO_COUNT_MAX] = {0}; // 前回の読み出し時刻(ms) 0: 未読み出し
+uint16_t health_save_pos = 0;                       // EEPROM への書き戻し位置 (sizeof(health_image): 書き戻していない)
+uint32_t health_save_time = 0;
+
+void health_stat_clear(HealthStat &stat) {
+  stat.min = HEALTH_SAMPLE_MAX;
+  stat.max = -HEALTH_SAMPLE_MAX;
+  stat.ewma = 0;
+  stat.over_time = 0;
+}
+
+void servo_health_clear(uint8_t index) {
+  health_stat_clear(servo_health[index].load);
+  health_stat_clear(servo_health[index].temperature);
+  health_stat_clear(servo_health[index].voltage);
+  servo_health[index].fail_count = 0;
+  servo_health[index].reboot_count = 0;
+  servo_health[index].temp_limit_count = 0;
+  servo_health[index].temp_alarm_count = 0;
+  servo_health[index].packet_error_count = 0;
+  servo_health[index].reserved = 0;
+}
+
+// EEPROM から統計を読み込む (目印が無ければ0から始める)
+void servo_health_setup() {
+  if (EEPROM.read(HEALTH_EEPROM_ADDR) == HEALTH_EEPROM_MAGIC) {
+    EEPROM.get(HEALTH_EEPROM_ADDR + 1, servo_health);
+  }
+  else {
+    for (uint8_t i = 0; i < SERVO_COUNT_MAX; i++) servo_health_clear(i);
+    EEPROM.put(HEALTH_EEPROM_ADDR + 1, servo_health);
+    EEPROM.update(HEALTH_EEPROM_ADDR, HEALTH_EEPROM_MAGIC);
+  }
+  memcpy(health_image, servo_health, sizeof(health_image));
+  health_save_pos = sizeof(health_image);
+  health_save_time = millis();
+}
+
+// 統計1項目に値 value を入れる over: しきい値を超えている, elapsed: 前回からの時間(ms)
+void health_stat_update(HealthStat &stat, uint16_t &over_ms, int16_t value, bool over, uint16_t elapsed) {
+  value = constrain(value, -HEALTH_SAMPLE_MAX, HEALTH_SAMPLE_MAX);
+  if (stat.min > stat.max) {
+    stat.min = value;
+    stat.max = value;
+    stat.ewma = value * HEALTH_EWMA_SCALE;
+  }
+  else {
+    if (value < stat.min) stat.min = value;
+    if (value > stat.max) stat.max = value;
+    stat.ewma += ((int32_t)value * HEALTH_EWMA_SCALE - stat.ewma) / HEALTH_EWMA_WEIGHT;
+  }
+  if (!over) return;
+  over_ms += elapsed;
+  while (over_ms >= 1000) {
+    over_ms -= 1000;
+    if (stat.over_time < 0xFFFF) stat.over_time++;
+  }
+}
+
+// 前回 0 だったフラグが 1 になったら数える
+void health_flag_count(uint8_t &count, uint8_t flags, uint8_t prev, uint8_t mask) {
+  if ((flags & mask) && !(prev & mask) && count < 0xFF) count++;
+}
+
+// 統計1項目が書き戻した値 saved から変わったか
+bool health_stat_changed(const HealthStat &stat, const HealthStat &saved, int16_t delta) {
+  return stat.min != saved.min || stat.max != saved.max || stat.over_time != saved.over_time
+         || abs(stat.ewma - saved.ewma) >= delta * HEALTH_EWMA_SCALE;
+}
+
+// 統計が書き戻した内容から意味のある変化をしたか
+bool servo_health_changed() {
+  for (uint8_t i = 0; i < SERVO_COUNT_MAX; i++) {
+    const ServoHealth &health = servo_health[i];
+    const ServoHealth &saved = health_image[i];
+    if (health_stat_changed(health.load,        saved.load,        health_save_delta[0])
+        || health_stat_changed(health.temperature, saved.temperature, health_save_delta[1])
+        || health_stat_changed(health.voltage,     saved.voltage,     health_save_delta[2])
+        || health.fail_count != saved.fail_count || health.reboot_count != saved.reboot_count
+        || health.temp_limit_count != saved.temp_limit_count || health.temp_alarm_count != saved.temp_alarm_count
+        || health.packet_error_count != saved.packet_error_count) return true;
+  }
+  return false;
+}
+
+// 統計を EEPROM に書き戻す (loop() の空き時間に呼ぶ)
+// 前回の書き戻しから HEALTH_SAVE_INTERVAL 以上経ち、統計が変わっていれば写しを取って書き始める
+// 1バイト書き込むと約3.3ms止まるので、EEPROM と同じバイトは読み飛ばし、1回に書き込むのは1バイトまでにする
+void servo_health_save() {
+  if (health_save_pos >= sizeof(health_image)) {
+    if ((uint32_t)(millis() - health_save_time) < HEALTH_SAVE_INTERVAL) return;
+    if (!servo_health_changed()) return;
+    memcpy(health_image, servo_health, sizeof(health_image));
+    health_save_pos = 0;
+  }
+  const uint8_t *image = (const uint8_t *)health_image;
+  while (health_save_pos < sizeof(health_image)) {
+    uint16_t address = HEALTH_EEPROM_ADDR + 1 + health_save_pos;
+    uint8_t value = image[health_save_pos++];
+    if (EEPROM.read(address) == value) continue;
+    EEPROM.write(address, value);
+    break;
+  }
+  if (health_save_pos >= sizeof(health_image)) health_save_time = millis();
+}
+
+// 状態の読み出し結果を統計に入れる (servo_receive_info() から呼ぶ)
+void servo_health_sample(uint8_t index, bool received) {
+  uint32_t now = millis();
+  uint16_t elapsed = health_sample_time[index] ? min(now - health_sample_time[index], HEALTH_INTERVAL_MAX) : 0;
+  health_sample_time[index] = now;
+  if (received) {
+    const ServoStatus &status = servo_status[index];
+    health_stat_update(servo_health[index].load,        health_over_ms[index][0], status.load,        status.load > HEALTH_LOAD_HIGH,          elapsed);
+    health_stat_update(servo_health[index].temperature, health_over_ms[index][1], status.temperature, status.temperature > HEALTH_TEMP_HIGH,   elapsed);
+    health_stat_update(servo_health[index].voltage,     health_over_ms[index][2], status.voltage,     status.voltage < HEALTH_VOLTAGE_LOW,     elapsed);
+    uint8_t flags = ServoInfoFlags::get(servo_rx_packet);
+    health_flag_count(servo_health[index].temp_limit_count,   flags, health_flags[index], SERVO_STATUS_TEMP_LIMIT);
+    health_flag_count(servo_health[index].temp_alarm_count,   flags, health_flags[index], SERVO_STATUS_TEMP_LIMIT_ALARM);
+    health_flag_count(servo_health[index].packet_error_count, flags, health_flags[index], SERVO_STATUS_PACKET_ERROR);
+    health_flags[index] = flags;
+  }
+  else if (servo_health[index].fail_count < 0xFFFF) {
+    servo_health[index].fail_count++;
+  }
+}
+
+// 再起動を数える (servo_bus_service() が再起動パケットを送信したときに呼ぶ)
+void servo_health_reboot(uint8_t index) {
+  if (index == 0xFF) return;
+  if (servo_health[index].reboot_count < 0xFFFF) servo_health[index].reboot_count++;
+}
+
+// 統計1項目を data に書き込む (DCM_HLT)
+void health_stat_put(uint8_t *data, const HealthStat &stat) {
+  bool empty = stat.min > stat.max;
+  PacketField<int16_t, HLT_STAT_MIN>::put(data, empty ? 0 : stat.min);
+  PacketField<int16_t, HLT_STAT_MAX>::put(data, empty ? 0 : stat.max);
+  PacketField<int16_t, HLT_STAT_EWMA>::put(data, stat.ewma / HEALTH_EWMA_SCALE);
+  PacketField<uint16_t, HLT_STAT_OVER>::put(data, stat.over_time);
+}
+
+// サーボ index の統計を DCM_HLT のデータ部 data に書き込む
+void servo_health_put(uint8_t *data, uint8_t index) {
+  const ServoHealth &health = servo_health[index];
+  data[HLT_ID] = servo_info[index].id;
+  health_stat_put(data + HLT_LOAD,        health.load);
+  health_stat_put(data + HLT_TEMPERATURE, health.temperature);
+  health_stat_put(data + HLT_VOLTAGE,     health.voltage);
+  PacketField<uint16_t, HLT_FAIL>::put(data, health.fail_count);
+  PacketField<uint16_t, HLT_REBOOT>::put(data, health.reboot_count);
+  data[HLT_TEMP_LIMIT]   = health.temp_limit_count;
+  data[HLT_TEMP_ALARM]   = health.temp_alarm_count;
+  data[HLT_PACKET_ERROR] = health.packet_error_count;
+}
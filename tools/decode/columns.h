@@ -0,0 +1,206 @@
+/*
+   解析結果の表の出力
+   CSV か、列ごとのバイナリファイル (リトルエンディアンの固定長配列, numpy.fromfile などでそのまま読める) に書き出す
+   バイナリの場合は DIR/表名/列名.bin と、列名と型を並べた DIR/表名/columns.txt を作る
+*/
+
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+enum ColumnType { COL_U8, COL_I16, COL_U16, COL_U32, COL_U64 };
+
+struct Column {
+  const char *name;
+  ColumnType type;
+};
+
+inline size_t column_size(ColumnType type) {
+  switch (type) {
+    case COL_U8:  return 1;
+    case COL_I16: return 2;
+    case COL_U16: return 2;
+    case COL_U32: return 4;
+    case COL_U64: return 8;
+  }
+  return 0;
+}
+
+inline const char *column_type_name(ColumnType type) {
+  switch (type) {
+    case COL_U8:  return "uint8";
+    case COL_I16: return "int16";
+    case COL_U16: return "uint16";
+    case COL_U32: return "uint32";
+    case COL_U64: return "uint64";
+  }
+  return "?";
+}
+
+#define TABLE_BUFFER (1 << 20) // 書き出しの単位(byte)
+
+class TableWriter {
+  public:
+    uint64_t rows = 0;
+    virtual ~TableWriter() {}
+    // 1行分の値 (列の数だけ)
+    virtual void row(const int64_t *values) = 0;
+    virtual bool close() = 0;
+};
+
+class CsvWriter : public TableWriter {
+  public:
+    CsvWriter(FILE *fp, const Column *columns, size_t count) : fp(fp), count(count), buf(TABLE_BUFFER + 64 * count), len(0) {
+      for (size_t c = 0; c < count; c++) {
+        if (c) buf[len++] = ',';
+        memcpy(&buf[len], columns[c].name, strlen(columns[c].name));
+        len += strlen(columns[c].name);
+      }
+      buf[len++] = '\n';
+    }
+
+    ~CsvWriter() {
+      close();
+    }
+
+    void row(const int64_t *values) {
+      char *p = &buf[len];
+      for (size_t c = 0; c < count; c++) {
+        if (c) *p++ = ',';
+        p = put_int(p, values[c]);
+      }
+      *p++ = '\n';
+      len = p - &buf[0];
+      rows++;
+      if (len >= TABLE_BUFFER) flush();
+    }
+
+    bool close() {
+      if (fp == NULL) return true;
+      flush();
+      bool ok = !ferror(fp);
+      ok = fclose(fp) == 0 && ok;
+      fp = NULL;
+      return ok;
+    }
+
+  private:
+    FILE *fp;
+    size_t count;
+    std::vector<char> buf; // 1行は最大 count * 21 文字
+    size_t len;
+
+    static char *put_int(char *p, int64_t v) {
+      char tmp[20];
+      char *t = tmp + sizeof(tmp);
+      uint64_t u = v < 0 ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+      do {
+        *--t = (char)('0' + u % 10);
+        u /= 10;
+      } while (u);
+      if (v < 0) *p++ = '-';
+      size_t n = tmp + sizeof(tmp) - t;
+      memcpy(p, t, n);
+      return p + n;
+    }
+
+    void flush() {
+      fwrite(&buf[0], 1, len, fp);
+      len = 0;
+    }
+};
+
+class ColumnWriter : public TableWriter {
+  public:
+    ColumnWriter(const Column *columns, size_t count) : columns(columns, columns + count), files(count, (FILE *)NULL),
+      bufs(count, std::vector<uint8_t>(TABLE_BUFFER)), len(0) {}
+
+    ~ColumnWriter() {
+      close();
+    }
+
+    // dir に列ごとのファイルと columns.txt を作る
+    bool open(const std::string &dir) {
+      FILE *schema = fopen((dir + "/columns.txt").c_str(), "w");
+      if (schema == NULL) return false;
+      for (size_t c = 0; c < columns.size(); c++) {
+        fprintf(schema, "%s %s\n", columns[c].name, column_type_name(columns[c].type));
+        files[c] = fopen((dir + "/" + columns[c].name + ".bin").c_str(), "wb");
+        if (files[c] == NULL) {
+          fclose(schema);
+          return false;
+        }
+      }
+      return fclose(schema) == 0;
+    }
+
+    // 各列のバッファには TABLE_BUFFER / 8 行ずつ溜める
+    void row(const int64_t *values) {
+      for (size_t c = 0; c < columns.size(); c++) {
+        uint64_t v = (uint64_t)values[c];
+        size_t size = column_size(columns[c].type);
+        uint8_t *p = &bufs[c][len * size];
+        for (size_t b = 0; b < size; b++) p[b] = (uint8_t)(v >> (8 * b));
+      }
+      rows++;
+      if (++len == TABLE_BUFFER / 8) flush();
+    }
+
+    bool close() {
+      bool ok = true;
+      if (!files.empty() && files[0] != NULL) flush();
+      for (size_t c = 0; c < files.size(); c++) {
+        if (files[c] == NULL) continue;
+        ok = !ferror(files[c]) && ok;
+        ok = fclose(files[c]) == 0 && ok;
+        files[c] = NULL;
+      }
+      return ok;
+    }
+
+  private:
+    std::vector<Column> columns;
+    std::vector<FILE *> files;
+    std::vector<std::vector<uint8_t> > bufs;
+    size_t len; // バッファに溜まっている行数
+
+    void flush() {
+      for (size_t c = 0; c < columns.size(); c++) fwrite(&bufs[c][0], column_size(columns[c].type), len, files[c]);
+      len = 0;
+    }
+};
+
+// dir に name という表を作る binary: 列ごとのバイナリ (dir/name/), それ以外: CSV (dir/name.csv)
+inline TableWriter *table_open(const std::string &dir, const char *name, const Column *columns, size_t count, bool binary) {
+  if (binary) {
+    std::string path = dir + "/" + name;
+    if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+      perror(path.c_str());
+      return NULL;
+    }
+    ColumnWriter *writer = new ColumnWriter(columns, count);
+    if (!writer->open(path)) {
+      perror(path.c_str());
+      delete writer;
+      return NULL;
+    }
+    return writer;
+  }
+  std::string path = dir + "/" + name + ".csv";
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (fp == NULL) {
+    perror(path.c_str());
+    return NULL;
+  }
+  return new CsvWriter(fp, columns, count);
+}
+
+#endif
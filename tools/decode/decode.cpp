@@ -0,0 +1,297 @@
+/*
+   計測基板・ESP パケットの記録の解析
+   入力はシリアルをそのまま記録したバイト列か、SERIAL_CAPTURE のトレース(tools/replay と同じ形式)
+   ファイルは mmap で読み、正しいパケットを表ごとに CSV か列ごとのバイナリに書き出す
+     sensory : 計測基板パケット (サーボ1台につき1行)
+     esp     : ESP パケットのヘッダー (両方向)
+     health  : DCM_HLT (サーボの健康状態の統計)
+     link    : DCM_LNK (通信量・エラーの集計)
+     bus     : DCM_BUS (サーボバスのクラス別使用状況)
+   offset はパケット先頭の入力上の位置 (トレースの場合は系統・方向ごとのバイト列上の位置)
+   time_us はトレースの場合のみ、パケットの最後のバイトが記録された時刻
+
+   ビルド (リポジトリのルートで):
+     g++ -std=gnu++11 -O2 -o decode tools/decode/decode.cpp
+   使い方:
+     decode [-b] [-o DIR] LOG
+       -b  列ごとのバイナリで書き出す (既定は CSV)
+       -o  書き出し先のディレクトリ (既定はカレントディレクトリ)
+*/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "telemetry.h"
+#include "columns.h"
+#include "../../trace_format.h"
+
+#define COLUMNS(c) c, sizeof(c) / sizeof(c[0])
+
+const Column sensory_columns[] = {
+  {"offset", COL_U64}, {"time_us", COL_U64}, {"servo", COL_U8}, {"flags", COL_U8},
+  {"goal_position", COL_I16}, {"goal_time", COL_U16}, {"max_torque", COL_U8}, {"torque_mode", COL_U8},
+  {"position", COL_I16}, {"present_time", COL_U16}, {"speed", COL_I16}, {"load", COL_I16},
+  {"temperature", COL_I16}, {"voltage", COL_I16}, {"estimate", COL_I16}, {"age", COL_U16},
+};
+
+const Column esp_columns[] = {
+  {"offset", COL_U64}, {"time_us", COL_U64}, {"direction", COL_U8}, {"device", COL_U8},
+  {"command", COL_U8}, {"length", COL_U8},
+};
+
+const Column health_columns[] = {
+  {"offset", COL_U64}, {"time_us", COL_U64}, {"servo", COL_U8},
+  {"load_min", COL_I16}, {"load_max", COL_I16}, {"load_ewma", COL_I16}, {"load_over_s", COL_U16},
+  {"temperature_min", COL_I16}, {"temperature_max", COL_I16}, {"temperature_ewma", COL_I16}, {"temperature_over_s", COL_U16},
+  {"voltage_min", COL_I16}, {"voltage_max", COL_I16}, {"voltage_ewma", COL_I16}, {"voltage_under_s", COL_U16},
+  {"fail", COL_U16}, {"reboot", COL_U16}, {"temp_limit", COL_U8}, {"temp_alarm", COL_U8}, {"packet_error", COL_U8},
+};
+
+const Column link_columns[] = {
+  {"offset", COL_U64}, {"time_us", COL_U64}, {"link", COL_U8}, {"tx_util", COL_U16}, {"rx_util", COL_U16},
+  {"tx_bytes", COL_U32}, {"rx_bytes", COL_U32}, {"frames_ok", COL_U16}, {"checksum_fail", COL_U16},
+  {"resync_discard", COL_U16}, {"timeouts", COL_U16}, {"flush_ms", COL_U32},
+};
+
+const Column bus_columns[] = {
+  {"offset", COL_U64}, {"time_us", COL_U64}, {"window_ms", COL_U16},
+  {"control_util", COL_U16}, {"control_wait_us", COL_U32}, {"control_dropped", COL_U16},
+  {"maintenance_util", COL_U16}, {"maintenance_wait_us", COL_U32}, {"maintenance_dropped", COL_U16},
+  {"telemetry_util", COL_U16}, {"telemetry_wait_us", COL_U32}, {"telemetry_dropped", COL_U16},
+};
+
+// 健康状態の統計1項目 (HLT_STAT_*) を values に並べる
+template <uint8_t OFFSET> int64_t *put_health_stat(int64_t *values, const uint8_t *data) {
+  *values++ = PacketField<int16_t, OFFSET + HLT_STAT_MIN>::get(data);
+  *values++ = PacketField<int16_t, OFFSET + HLT_STAT_MAX>::get(data);
+  *values++ = PacketField<int16_t, OFFSET + HLT_STAT_EWMA>::get(data);
+  *values++ = PacketField<uint16_t, OFFSET + HLT_STAT_OVER>::get(data);
+  return values;
+}
+
+// サーボバスの1クラスの集計 (BUS_STAT_*) を values に並べる
+template <uint8_t OFFSET> int64_t *put_bus_stat(int64_t *values, const uint8_t *data) {
+  *values++ = PacketField<uint16_t, OFFSET + BUS_STAT_UTIL>::get(data);
+  *values++ = PacketField<uint32_t, OFFSET + BUS_STAT_WAIT>::get(data);
+  *values++ = PacketField<uint16_t, OFFSET + BUS_STAT_DROPPED>::get(data);
+  return values;
+}
+
+struct Decoder {
+  TableWriter *sensory;
+  TableWriter *esp;
+  TableWriter *health;
+  TableWriter *link;
+  TableWriter *bus;
+  uint64_t time_us = 0;
+
+  void operator()(const Frame &frame) {
+    int64_t values[24];
+    if (frame.kind == FRAME_SENSORY) {
+      bool estimate = sensory_has_estimate(frame);
+      uint8_t slot_len = sensory_slot_len(frame);
+      if (slot_len < SENSORY_SLOT_ESTIMATE) return; // スロットが短すぎる (想定外の版)
+      for (uint8_t slot = 0; slot < SENSORY_SLOT_COUNT; slot++) {
+        const uint8_t *p = sensory_slot(frame, slot);
+        int64_t *v = values;
+        *v++ = frame.offset;
+        *v++ = time_us;
+        *v++ = slot + 1;
+        *v++ = SensorySlotFlags::get(p);
+        *v++ = SensorySlotGoalPosition::get(p);
+        *v++ = SensorySlotGoalTime::get(p);
+        *v++ = SensorySlotMaxTorque::get(p);
+        *v++ = SensorySlotTorqueMode::get(p);
+        *v++ = SensorySlotPosition::get(p);
+        *v++ = SensorySlotPresentTime::get(p);
+        *v++ = SensorySlotSpeed::get(p);
+        *v++ = SensorySlotLoad::get(p);
+        *v++ = SensorySlotTemperature::get(p);
+        *v++ = SensorySlotVoltage::get(p);
+        *v++ = estimate ? SensorySlotEstimate::get(p) : SensorySlotPosition::get(p);
+        *v++ = estimate ? SensorySlotAge::get(p) : SENSORY_AGE_NONE;
+        sensory->row(values);
+      }
+      return;
+    }
+
+    values[0] = frame.offset;
+    values[1] = time_us;
+    values[2] = frame.kind == FRAME_ESP_TX ? 0 : 1;
+    values[3] = esp_device(frame);
+    values[4] = esp_command(frame);
+    values[5] = esp_data_len(frame);
+    esp->row(values);
+    if (frame.kind != FRAME_ESP_TX) return;
+
+    const uint8_t *data = esp_data(frame);
+    if (esp_command(frame) == DCM_HLT && esp_data_len(frame) == HLT_DATA_LEN) {
+      int64_t *v = values + 2;
+      *v++ = data[HLT_ID];
+      v = put_health_stat<HLT_LOAD>(v, data);
+      v = put_health_stat<HLT_TEMPERATURE>(v, data);
+      v = put_health_stat<HLT_VOLTAGE>(v, data);
+      *v++ = PacketField<uint16_t, HLT_FAIL>::get(data);
+      *v++ = PacketField<uint16_t, HLT_REBOOT>::get(data);
+      *v++ = data[HLT_TEMP_LIMIT];
+      *v++ = data[HLT_TEMP_ALARM];
+      *v++ = data[HLT_PACKET_ERROR];
+      health->row(values);
+    }
+    else if (esp_command(frame) == DCM_LNK && esp_data_len(frame) == LNK_DATA_LEN) {
+      int64_t *v = values + 2;
+      *v++ = data[LNK_LINK];
+      *v++ = PacketField<uint16_t, LNK_TX_UTIL>::get(data);
+      *v++ = PacketField<uint16_t, LNK_RX_UTIL>::get(data);
+      *v++ = PacketField<uint32_t, LNK_TX_BYTES>::get(data);
+      *v++ = PacketField<uint32_t, LNK_RX_BYTES>::get(data);
+      *v++ = PacketField<uint16_t, LNK_FRAMES_OK>::get(data);
+      *v++ = PacketField<uint16_t, LNK_CHECKSUM_FAIL>::get(data);
+      *v++ = PacketField<uint16_t, LNK_RESYNC_DISCARD>::get(data);
+      *v++ = PacketField<uint16_t, LNK_TIMEOUTS>::get(data);
+      *v++ = PacketField<uint32_t, LNK_FLUSH_TIME>::get(data);
+      link->row(values);
+    }
+    else if (esp_command(frame) == DCM_BUS && esp_data_len(frame) == BUS_DATA_LEN) {
+      int64_t *v = values + 2;
+      *v++ = PacketField<uint16_t, BUS_WINDOW>::get(data);
+      v = put_bus_stat<BUS_STATS>(v, data);
+      v = put_bus_stat<BUS_STATS + BUS_STAT_LEN>(v, data);
+      v = put_bus_stat<BUS_STATS + 2 * BUS_STAT_LEN>(v, data);
+      bus->row(values);
+    }
+  }
+};
+
+// トレースの計測基板・ESP の送受信を系統・方向ごとの FrameParser に流す
+// parsers: [0] 計測基板への送信, [1] ESP への送信, [2] ESP からの受信
+bool decode_trace(const uint8_t *buf, size_t size, FrameParser *parsers, Decoder &decoder) {
+  size_t pos = trace_header_len(buf, size);
+  uint64_t t = 0;
+  while (pos < size) {
+    uint8_t tag = buf[pos++];
+    uint64_t elapsed = 0;
+    for (uint8_t shift = 0; ; shift += 7) {
+      if (pos >= size || shift > 28) {
+        fprintf(stderr, "truncated trace record at offset %zu\n", pos);
+        return false;
+      }
+      uint8_t b = buf[pos++];
+      elapsed |= (uint64_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) break;
+    }
+    t += elapsed;
+    uint8_t len = trace_tag_len(tag);
+    if (pos + len > size) {
+      fprintf(stderr, "truncated trace record at offset %zu\n", pos);
+      return false;
+    }
+    uint8_t link = trace_tag_link(tag);
+    uint8_t dir = trace_tag_dir(tag);
+    FrameParser *parser = NULL;
+    if (link == LINK_SENSORY && dir == TRACE_TX) parser = &parsers[0];
+    if (link == LINK_ESP && dir == TRACE_TX)     parser = &parsers[1];
+    if (link == LINK_ESP && dir == TRACE_RX)     parser = &parsers[2];
+    if (parser != NULL) {
+      decoder.time_us = t;
+      parser->feed(buf + pos, len, decoder);
+    }
+    pos += len;
+  }
+  return true;
+}
+
+void print_stats(const char *name, const ParserStats &stats) {
+  fprintf(stderr, "%-10s %14llu bytes %10llu sensory %10llu esp_tx %10llu esp_rx %8llu checksum_fail %10llu discarded\n", name,
+          (unsigned long long)stats.bytes, (unsigned long long)stats.frames[FRAME_SENSORY],
+          (unsigned long long)stats.frames[FRAME_ESP_TX], (unsigned long long)stats.frames[FRAME_ESP_RX],
+          (unsigned long long)stats.checksum_fail, (unsigned long long)stats.discarded);
+}
+
+int main(int argc, char **argv) {
+  bool binary = false;
+  std::string dir = ".";
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0) binary = true;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) dir = argv[++i];
+    else path = argv[i];
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s [-b] [-o DIR] LOG\n", argv[0]);
+    return 2;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(path);
+    return 1;
+  }
+  size_t size = (size_t)st.st_size;
+  const uint8_t *buf = NULL;
+  if (size > 0) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      perror(path);
+      return 1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    buf = (const uint8_t *)map;
+  }
+
+  if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+    perror(dir.c_str());
+    return 1;
+  }
+  Decoder decoder;
+  decoder.sensory = table_open(dir, "sensory", COLUMNS(sensory_columns), binary);
+  decoder.esp     = table_open(dir, "esp",     COLUMNS(esp_columns),     binary);
+  decoder.health  = table_open(dir, "health",  COLUMNS(health_columns),  binary);
+  decoder.link    = table_open(dir, "link",    COLUMNS(link_columns),    binary);
+  decoder.bus     = table_open(dir, "bus",     COLUMNS(bus_columns),     binary);
+  if (!decoder.sensory || !decoder.esp || !decoder.health || !decoder.link || !decoder.bus) return 1;
+
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  bool trace = trace_header_len(buf, size) > 0;
+  bool ok = true;
+  if (trace) {
+    FrameParser parsers[3];
+    ok = decode_trace(buf, size, parsers, decoder);
+    for (uint8_t i = 0; i < 3; i++) parsers[i].finish(decoder);
+    print_stats("sensory_tx", parsers[0].stats);
+    print_stats("esp_tx", parsers[1].stats);
+    print_stats("esp_rx", parsers[2].stats);
+  }
+  else {
+    FrameParser parser;
+    parser.parse_all(buf, size, decoder);
+    print_stats("log", parser.stats);
+  }
+  ok = decoder.sensory->close() && ok;
+  ok = decoder.esp->close() && ok;
+  ok = decoder.health->close() && ok;
+  ok = decoder.link->close() && ok;
+  ok = decoder.bus->close() && ok;
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  fprintf(stderr, "rows: sensory %llu, esp %llu, health %llu, link %llu, bus %llu\n",
+          (unsigned long long)decoder.sensory->rows, (unsigned long long)decoder.esp->rows,
+          (unsigned long long)decoder.health->rows, (unsigned long long)decoder.link->rows,
+          (unsigned long long)decoder.bus->rows);
+  fprintf(stderr, "%.1f MB in %.3f s (%.0f MB/s)\n", size / 1e6, elapsed, elapsed > 0 ? size / 1e6 / elapsed : 0.0);
+  delete decoder.sensory;
+  delete decoder.esp;
+  delete decoder.health;
+  delete decoder.link;
+  delete decoder.bus;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+/*
+   計測基板・ESP パケットの解析 (地上局ツール用ライブラリ)
+   パケット構造はファームウェアと同じ packet_schema.h を使うので、ファームウェア側を変えればこちらも追従する
+   FrameParser に任意の区切りでバイト列を渡すと、ヘッダーを探してチェックサムを確かめ、正しいパケットごとに sink を呼ぶ
+   チェックサムが合わない・長さがおかしいパケットは先頭1バイトだけ捨ててヘッダーを探し直す(正しいパケットを巻き込まない)
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../../packet_schema.h"
+
+enum FrameKind {
+  FRAME_SENSORY, // 操舵基板 → 計測基板 (7C C7)
+  FRAME_ESP_TX,  // 操舵基板 → ESP      (8D D8)
+  FRAME_ESP_RX,  // ESP → 操舵基板      (8F F8)
+  FRAME_KINDS
+};
+
+#define FRAME_MAX 255 // checksum() が扱えるパケット長の上限
+
+struct Frame {
+  FrameKind kind;
+  const uint8_t *data; // ヘッダーからチェックサムまで (sink から戻ると無効になる)
+  uint8_t len;
+  uint64_t offset;     // 入力の先頭からの位置
+};
+
+struct ParserStats {
+  uint64_t bytes = 0;                  // 受け取ったバイト数
+  uint64_t frames[FRAME_KINDS] = {0};  // 正しいパケット数
+  uint64_t checksum_fail = 0;          // ヘッダーと長さは読めたがチェックサムが合わなかった数
+  uint64_t discarded = 0;              // パケットにならずに捨てたバイト数
+};
+
+// ヘッダー2バイトからパケットの種類を決める (FRAME_KINDS: ヘッダーではない)
+inline FrameKind frame_kind(uint8_t h0, uint8_t h1) {
+  if (h0 == SENSORY_HEADER_0 && h1 == SENSORY_HEADER_1) return FRAME_SENSORY;
+  if (h0 == ESP_TX_HEADER_0 && h1 == ESP_TX_HEADER_1) return FRAME_ESP_TX;
+  if (h0 == ESP_RX_HEADER_0 && h1 == ESP_RX_HEADER_1) return FRAME_ESP_RX;
+  return FRAME_KINDS;
+}
+
+// 長さのバイトまで読むのに必要なバイト数
+inline size_t frame_prefix(FrameKind kind) {
+  return kind == FRAME_SENSORY ? SENSORY_PKT_LENGTH + 1 : ESP_PKT_LENGTH + 1;
+}
+
+// パケット全体の長さ (0: 長さがおかしい)
+inline size_t frame_length(FrameKind kind, const uint8_t *p) {
+  size_t len;
+  if (kind == FRAME_SENSORY) len = SENSORY_PKT_DATA + p[SENSORY_PKT_LENGTH] + 1;
+  else                       len = esp_packet_len(0) + p[ESP_PKT_LENGTH];
+  return len <= FRAME_MAX ? len : 0;
+}
+
+class FrameParser {
+  public:
+    ParserStats stats;
+
+    // 続きのバイト列を渡す 最後のパケットが途中で切れていれば次の feed() まで持ち越す
+    template <class Sink> void feed(const uint8_t *p, size_t n, Sink &sink) {
+      stats.bytes += n;
+      while (n > 0 && carry_len > 0) {
+        // 持ち越し分に最大長1つ分だけ足して解析し、持ち越しを使い切ったら p を直接解析する
+        size_t old_len = carry_len;
+        size_t k = n < FRAME_MAX ? n : FRAME_MAX;
+        memcpy(carry + carry_len, p, k);
+        carry_len += k;
+        size_t used = scan(carry, carry_len, carry_offset, false, sink);
+        if (used >= old_len) {
+          p += used - old_len;
+          n -= used - old_len;
+          carry_offset += used;
+          carry_len = 0;
+          break;
+        }
+        memmove(carry, carry + used, carry_len - used);
+        carry_len -= used;
+        carry_offset += used;
+        p += k;
+        n -= k;
+      }
+      if (n == 0) return;
+      size_t used = scan(p, n, next_offset(n), false, sink);
+      memcpy(carry, p + used, n - used);
+      carry_offset = next_offset(n) + used;
+      carry_len = n - used;
+    }
+
+    // 入力の終わり 持ち越し分を解析し、残りは捨てる
+    template <class Sink> void finish(Sink &sink) {
+      scan(carry, carry_len, carry_offset, true, sink);
+      carry_offset += carry_len;
+      carry_len = 0;
+    }
+
+    // 入力全体が手元にあるとき (mmap したファイルなど)
+    template <class Sink> void parse_all(const uint8_t *p, size_t n, Sink &sink) {
+      stats.bytes += n;
+      scan(p, n, carry_offset, true, sink);
+      carry_offset += n;
+    }
+
+  private:
+    uint8_t carry[2 * FRAME_MAX];
+    size_t carry_len = 0;
+    uint64_t carry_offset = 0; // carry[0] の入力上の位置
+
+    // 長さ n の新しいバイト列の先頭の入力上の位置
+    uint64_t next_offset(size_t) const {
+      return carry_offset + carry_len;
+    }
+
+    // p[0..n) からパケットを取り出し、解析を終えたバイト数を返す
+    // final でなければ、途中で切れているかもしれないパケットの手前で止める
+    template <class Sink> size_t scan(const uint8_t *p, size_t n, uint64_t base, bool final, Sink &sink) {
+      size_t i = 0;
+      while (i < n) {
+        size_t j = i;
+        while (j < n && p[j] != SENSORY_HEADER_0 && p[j] != ESP_TX_HEADER_0 && p[j] != ESP_RX_HEADER_0) j++;
+        stats.discarded += j - i;
+        i = j;
+        if (n - i < 2) break;
+        FrameKind kind = frame_kind(p[i], p[i + 1]);
+        if (kind == FRAME_KINDS) {
+          stats.discarded++;
+          i++;
+          continue;
+        }
+        if (n - i < frame_prefix(kind)) break;
+        size_t len = frame_length(kind, p + i);
+        if (len == 0) {
+          stats.discarded++;
+          i++;
+          continue;
+        }
+        if (n - i < len) break;
+        if (p[i + len - 1] != checksum(p + i, (uint8_t)(len - 1))) {
+          stats.checksum_fail++;
+          stats.discarded++;
+          i++;
+          continue;
+        }
+        Frame frame = {kind, p + i, (uint8_t)len, base + i};
+        stats.frames[kind]++;
+        sink(frame);
+        i += len;
+      }
+      if (final) {
+        stats.discarded += n - i;
+        return n;
+      }
+      return i;
+    }
+};
+
+// ---------- パケットの中身 ------------------------------------------------------------------- //
+
+// 計測基板パケットのスロット数 (スロット長はファームウェアの版で異なる: 19 → 23)
+inline uint8_t sensory_slot_len(const Frame &frame) {
+  return frame.data[SENSORY_PKT_LENGTH] / SENSORY_SLOT_COUNT;
+}
+
+// 計測基板パケットの slot 番目 (サーボID - 1) のスロットの先頭
+inline const uint8_t *sensory_slot(const Frame &frame, uint8_t slot) {
+  return frame.data + SENSORY_PKT_DATA + slot * sensory_slot_len(frame);
+}
+
+// 推定位置・経過時間を含む版か
+inline bool sensory_has_estimate(const Frame &frame) {
+  return sensory_slot_len(frame) >= SENSORY_SLOT_LEN;
+}
+
+inline uint8_t esp_device(const Frame &frame) {
+  return frame.data[ESP_PKT_DEVICE];
+}
+
+inline uint8_t esp_command(const Frame &frame) {
+  return frame.data[ESP_PKT_COMMAND];
+}
+
+inline uint8_t esp_data_len(const Frame &frame) {
+  return frame.data[ESP_PKT_LENGTH];
+}
+
+inline const uint8_t *esp_data(const Frame &frame) {
+  return frame.data + ESP_PKT_DATA;
+}
+
+#endif
@@ -0,0 +1,1110 @@
+/*
+   ESP の代わり (地上局のスタンドイン) と ESP 通信の負荷試験
+   ESP 側として 0x8F 0xF8 のコマンドを送り、操舵基板からの返信(0x8D 0xD8)を受けて
+   コマンドから返信までの時間・返信の無かったコマンド・受信の立ち直り(ヘッダーの探し直し)を集計する
+
+   相手は次のどちらか
+     シミュレーション (既定): tools/replay の互換層で PC 上にビルドしたファームウェアを仮想時計で動かす
+       サーボも模擬するので、操舵パケットの間隔(制御ループが時間通りに回っているか)も測れる
+       受信バッファ(64バイト)のあふれも再現する
+     -d DEVICE: 実機の ESP 用シリアル (USB シリアル変換器や pty) と実時間でやり取りする
+
+   -s はコマンド一式(確認応答 CMD_PRP による承認・拒否を含む)を順に送り、返信の中身を確かめる
+   -T はラダーを試験モードにして、-r の頻度で CMD_TMV の目標位置を送り続ける (最後に試験モードを戻す)
+     操舵基板は未送信の目標位置を新しいもので上書きするので、サーボに届いた数(applied)と飛ばされた数(skipped)、
+     CMD_TMV からサーボへの書き込みまでの時間、最後に送った目標位置が書き込まれたか(last)を集計する
+     (実機ではラダーが ±50° の範囲で動くので注意 サーボへの書き込みはシミュレーションでしか数えられない)
+   それ以外は、-r の頻度(コマンド/秒)で正しいパケット・壊れたパケット・続けて送るパケットを混ぜて送り続ける
+   確認が必要なコマンドは CMD_PRP で拒否するので、負荷試験でサーボの設定や EEPROM は変わらない
+   返信は種類(DCM_*)でしか見分けられないので、返信を待つコマンドは返信の種類ごとに同時に1つだけにする
+   (1つ返信が失われても後の返信と取り違えない) 正しいパケットを送る時にどの種類も返信待ちなら、
+   返信の無い CMD_TMV (試験モードでないサーボ宛てなので拒否される) を代わりに送り fill に数える
+
+   ビルド (リポジトリのルートで):
+     g++ -std=gnu++11 -O2 -I tools/replay/arduino -o espsim tools/espsim/espsim.cpp
+   使い方:
+     espsim [-s | -T] [-v] [-d DEVICE] [-r RATE[,RATE...]] [-t 秒] [-m MIX] [-x SEED]
+       -s  コマンド一式の確認だけ行う (失敗があれば終了コード 1)
+       -T  CMD_TMV を送り続ける (試験モードを切り替えられないか、最後の目標位置が書き込まれなければ終了コード 1)
+       -v  ファームウェアのデバッグ出力を表示する (シミュレーションのみ)
+       -d  実機のシリアル DEVICE を使う
+       -r  送信頻度(パケット/秒) カンマ区切りで複数指定すると順に試す (既定 10)
+       -t  1つの頻度で送り続ける時間(秒, 既定 10)
+       -m  送るパケットの割合 正常,チェックサム誤り,長さ誤り,途中切れ,雑音,連結 (既定 70,5,5,5,5,10)
+       -x  乱数の種 (既定 1)
+*/
+
+#include <chrono> // Arduino.h の min/max マクロより先に読み込む
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "../../WASA-Control.ino"
+#include "../decode/telemetry.h"
+
+uint64_t sim_now = 0;
+SimAnalog sim_analog[64];
+HardwareSerial Serial, Serial1, Serial2, Serial3;
+EEPROMClass EEPROM;
+
+#define STATION_DEVICE   0x01       // ESP のデバイスID
+#define REPLY_TIMEOUT    3000000ULL // 返信を待つ時間(us) これを過ぎたら返信なしとする
+#define SETTLE_TIME      1000000ULL // 起動してから送り始めるまでの時間(us)
+#define SCRIPT_GAP       50000ULL   // 確認手順の1項目ごとの間隔(us)
+#define SCRIPT_QUIET     300000ULL  // 返信が無いことを確かめる時間(us)
+#define BACKLOG_MAX      1000000ULL // 送信待ちがこれ以上溜まっていたら送らずに数える(us)
+#define THINK_TIME       2000ULL    // 確認パケットを受けてから CMD_PRP を返すまで(us)
+#define SIM_RX_BUFFER    64         // Arduino の HardwareSerial の受信バッファ(byte)
+#define SIM_SERVO_REPLY  300        // 模擬サーボが返信を始めるまで(us)
+#define STREAM_AMPLITUDE 500        // -T で送る目標位置の範囲 ±(0.1°)
+#define STREAM_STEP      10         // -T で送る目標位置の1回ごとの変化(0.1°)
+
+// ---------- 集計 ----------------------------------------------------------------------------- //
+
+struct Samples {
+  std::vector<uint64_t> values;
+
+  void add(uint64_t v) {
+    values.push_back(v);
+  }
+  // 百分位 (p: 0〜100) 値が無ければ 0
+  uint64_t percentile(double p) const {
+    if (values.empty()) return 0;
+    std::vector<uint64_t> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+  }
+};
+
+// ---------- 送信路 --------------------------------------------------------------------------- //
+
+// ESP → 操舵基板の送信路 (1本の線なので、送ったパケットは順に1バイトずつ届く)
+class EspWire {
+  public:
+    uint64_t next_free = 0;   // 送信中のデータが最後まで届く時刻
+    uint32_t byte_time = (uint32_t)(10000000UL / ESP_BAUDRATE);
+    uint64_t bytes = 0;
+
+    virtual ~EspWire() {}
+    virtual uint64_t now() = 0;
+    // earliest 以降に送り、最後のバイトが届く時刻を返す
+    uint64_t send(const std::vector<uint8_t> &data, uint64_t earliest) {
+      uint64_t t = earliest > next_free ? earliest : next_free;
+      queue(data, t);
+      next_free = t + (uint64_t)byte_time * data.size();
+      bytes += data.size();
+      return next_free;
+    }
+
+  protected:
+    virtual void queue(const std::vector<uint8_t> &data, uint64_t begin) = 0;
+};
+
+// シミュレーション: 届く時刻になったバイトを受信バッファに移す (あふれた分は捨てる)
+class SimWire : public EspWire {
+  public:
+    uint32_t overflow = 0;
+
+    uint64_t now() {
+      return sim_now;
+    }
+    void deliver() {
+      while (!pending.empty() && pending.front().first <= sim_now) {
+        if (ESP_SERIAL.rx.size() < SIM_RX_BUFFER) ESP_SERIAL.rx.push_back(pending.front());
+        else overflow++;
+        pending.pop_front();
+      }
+    }
+
+  protected:
+    void queue(const std::vector<uint8_t> &data, uint64_t begin) {
+      for (size_t i = 0; i < data.size(); i++) pending.push_back(std::make_pair(begin + (uint64_t)byte_time * (i + 1), data[i]));
+    }
+
+  private:
+    std::deque<std::pair<uint64_t, uint8_t> > pending;
+};
+
+// 実機: 送る時刻になったパケットを書き込む (ボーレートでの送信はドライバに任せる)
+class TtyWire : public EspWire {
+  public:
+    int fd;
+
+    TtyWire(int fd) : fd(fd), begin(std::chrono::steady_clock::now()) {}
+
+    uint64_t now() {
+      return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+    }
+    bool flush_due() {
+      uint64_t t = now();
+      while (!pending.empty() && pending.front().first <= t) {
+        const std::vector<uint8_t> &data = pending.front().second;
+        if (write(fd, data.data(), data.size()) != (ssize_t)data.size()) return false;
+        pending.pop_front();
+      }
+      return true;
+    }
+
+  protected:
+    void queue(const std::vector<uint8_t> &data, uint64_t begin) {
+      pending.push_back(std::make_pair(begin, data));
+    }
+
+  private:
+    std::chrono::steady_clock::time_point begin;
+    std::deque<std::pair<uint64_t, std::vector<uint8_t> > > pending;
+};
+
+// ---------- ESP のスタンドイン --------------------------------------------------------------- //
+
+// ESP → 操舵基板のパケット
+std::vector<uint8_t> esp_command_frame(uint8_t command, const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> p(esp_packet_len((uint8_t)data.size()));
+  p[0] = ESP_RX_HEADER_0;
+  p[1] = ESP_RX_HEADER_1;
+  p[ESP_PKT_DEVICE] = STATION_DEVICE;
+  p[ESP_PKT_COMMAND] = command;
+  p[ESP_PKT_LENGTH] = (uint8_t)data.size();
+  std::copy(data.begin(), data.end(), p.begin() + ESP_PKT_DATA);
+  p[p.size() - 1] = checksum(p.data(), (uint8_t)(p.size() - 1));
+  return p;
+}
+
+std::vector<uint8_t> int16_bytes(uint8_t head, int16_t v) {
+  std::vector<uint8_t> d;
+  d.push_back(head);
+  d.push_back(lowByte((uint16_t)v));
+  d.push_back(highByte((uint16_t)v));
+  return d;
+}
+
+// 送るパケットの種類 (-m の順)
+enum MixKind { MIX_VALID, MIX_CHECKSUM, MIX_LENGTH, MIX_TRUNCATED, MIX_NOISE, MIX_INTERLEAVED, MIX_KINDS };
+const char *const mix_names[MIX_KINDS] = {"valid", "checksum", "length", "truncated", "noise", "interleaved"};
+
+// 負荷試験で送る要求 (CMD_REQ) と返信
+struct LoadRequest {
+  uint8_t request;   // REQ_*
+  uint8_t expect;    // DCM_*
+  uint8_t count;     // 返信のパケット数
+};
+
+const LoadRequest load_requests[] = {
+  {REQ_INI, DCM_DSP, 1},
+  {REQ_BUS, DCM_BUS, 1},
+  {REQ_HLT, DCM_HLT, SERVO_COUNT_MAX},
+};
+
+#define LOAD_REQUESTS (sizeof(load_requests) / sizeof(load_requests[0]))
+
+// 返信を待っているもの
+enum Probe {
+  PROBE_REQ,         // CMD_REQ / load_requests のどれか
+  PROBE_CONFIRM,     // CMD_TQS → DCM_PRP
+  PROBE_PRP,         // CMD_PRP (拒否) → DCM_DSP
+  PROBE_INTERLEAVED, // 壊れたパケットの直後に続けて送った CMD_REQ
+  PROBE_LINK,        // CMD_REQ / REQ_LNK → DCM_LNK × LINKS
+  PROBE_SCRIPT,      // 確認手順の1項目
+  PROBE_STREAM,      // -T の試験モードの切り替え CMD_TMD → DCM_PRP, CMD_PRP (承認) → DCM_DSP
+  PROBES
+};
+
+struct Pending {
+  uint8_t expect;    // 待っている DCM_*
+  uint8_t count;     // 残りのパケット数
+  uint8_t probe;
+  uint64_t sent;     // コマンドの最後のバイトが届いた時刻
+  uint64_t deadline;
+};
+
+// 確認手順の1項目
+struct ScriptStep {
+  const char *name;
+  std::vector<uint8_t> frame;
+  int16_t expect;        // 返ってくるパケット (DCM_*, -1: 返信が無いことを確かめる)
+  uint8_t count;
+  int8_t prp;            // 確認パケットへの返事 (-1: 確認なし 0: 拒否 1: 承認)
+  int8_t check_offset;   // 最後の DCM_DSP のデータの位置 (-1: 確かめない)
+  uint8_t check_size;
+  int16_t check_value;
+};
+
+// ESP 用シリアルの集計 (DCM_LNK の LNK_*)
+struct LinkSnapshot {
+  uint16_t frames_ok = 0;
+  uint16_t checksum_fail = 0;
+  uint16_t resync_discard = 0;
+  uint16_t timeouts = 0;
+};
+
+enum Phase { PHASE_SETTLE, PHASE_LINK_BEGIN, PHASE_RUN, PHASE_DRAIN, PHASE_LINK_END, PHASE_DONE };
+
+// -T の手順
+enum StreamPhase { STREAM_ENABLE, STREAM_RUN, STREAM_DISABLE, STREAM_DONE };
+
+// 送った目標位置とその時刻 (CMD_TMV の最後のバイトが届いた時刻、またはサーボに書き込まれた時刻)
+typedef std::vector<std::pair<uint64_t, int16_t> > GoalLog;
+
+class EspStation {
+  public:
+    // 集計
+    uint32_t offered = 0;             // 送ろうとしたパケット数
+    uint32_t skipped = 0;             // 送信待ちが溜まっていて送らなかった数
+    uint32_t filled = 0;              // どの種類も返信待ちで、返信の無いパケットを代わりに送った数
+    uint32_t sent[MIX_KINDS] = {0};
+    uint32_t answered[PROBES] = {0};
+    uint32_t dropped[PROBES] = {0};
+    uint32_t unsolicited = 0;         // 待っていなかった返信
+    Samples latency;                  // コマンドから返信まで(us)
+    LinkSnapshot link_begin, link_end;
+    uint64_t run_begin = 0, run_end = 0;
+    uint32_t script_failures = 0;
+    GoalLog stream_sent;              // -T で送った CMD_TMV
+    uint64_t stream_end = 0;          // 試験モードを戻した時刻 (これ以降のサーボへの書き込みは操縦桿による)
+    uint32_t stream_failures = 0;
+
+    EspStation(EspWire &wire, bool script, bool stream, double rate, double seconds, const uint32_t *mix, uint32_t seed)
+      : wire(wire), script(script), stream(stream), rate(rate), seconds(seconds), rng(seed ? seed : 1) {
+      mix_total = 0;
+      for (uint8_t k = 0; k < MIX_KINDS; k++) {
+        this->mix[k] = mix[k];
+        mix_total += mix[k];
+      }
+      if (script) script_build();
+    }
+
+    bool done() const {
+      return phase == PHASE_DONE;
+    }
+
+    // 操舵基板から1バイト受け取った
+    void on_byte(uint8_t c, uint64_t at) {
+      frame_time = at;
+      parser.feed(&c, 1, *this);
+    }
+
+    // 受け取ったパケット (FrameParser から呼ばれる)
+    void operator()(const Frame &frame) {
+      if (frame.kind != FRAME_ESP_TX) return;
+      uint8_t dcm = esp_command(frame);
+      if (dcm == DCM_LNK && esp_data_len(frame) >= LNK_DATA_LEN && esp_data(frame)[LNK_LINK] == LINK_ESP) {
+        const uint8_t *d = esp_data(frame);
+        link_last.frames_ok      = PacketField<uint16_t, LNK_FRAMES_OK>::get(d);
+        link_last.checksum_fail  = PacketField<uint16_t, LNK_CHECKSUM_FAIL>::get(d);
+        link_last.resync_discard = PacketField<uint16_t, LNK_RESYNC_DISCARD>::get(d);
+        link_last.timeouts       = PacketField<uint16_t, LNK_TIMEOUTS>::get(d);
+      }
+      for (std::deque<Pending>::iterator it = pending.begin(); it != pending.end(); ++it) {
+        if (it->expect != dcm) continue;
+        if (--it->count > 0) return;
+        Pending p = *it;
+        pending.erase(it);
+        complete(p, frame);
+        return;
+      }
+      unsolicited++;
+    }
+
+    void tick(uint64_t now) {
+      while (!pending.empty() && pending.front().deadline <= now) {
+        Pending p = pending.front();
+        pending.pop_front();
+        timeout(p);
+      }
+      switch (phase) {
+        case PHASE_SETTLE:
+          if (now < SETTLE_TIME) break;
+          request_links(now);
+          phase = PHASE_LINK_BEGIN;
+          break;
+        case PHASE_LINK_BEGIN:
+        case PHASE_LINK_END:
+          break;
+        case PHASE_RUN:
+          if (script) script_tick(now);
+          else if (stream) stream_tick(now);
+          else load_tick(now);
+          break;
+        case PHASE_DRAIN:
+          if (!pending.empty() || wire.next_free > now) break;
+          request_links(now);
+          phase = PHASE_LINK_END;
+          break;
+        case PHASE_DONE:
+          break;
+      }
+    }
+
+  private:
+    EspWire &wire;
+    bool script;
+    bool stream;
+    double rate;
+    double seconds;
+    uint32_t mix[MIX_KINDS];
+    uint32_t mix_total;
+    uint32_t rng;
+    Phase phase = PHASE_SETTLE;
+    FrameParser parser;
+    uint64_t frame_time = 0;
+    std::deque<Pending> pending;
+    LinkSnapshot link_last;
+
+    uint64_t next_time = 0;           // 次のパケットを送る時刻
+    bool confirm_open = false;        // 確認待ちのコマンドがある (操舵基板は同時に1つしか受け付けない)
+    bool alternate = false;
+    uint8_t request_next = 0;         // 次に送る load_requests
+
+    std::vector<ScriptStep> steps;
+    size_t step = 0;
+    bool step_busy = false;
+    uint8_t step_phase = 0;           // 0: コマンドの返信待ち 1: CMD_PRP の返信待ち
+    uint64_t step_begin = 0;
+    uint64_t step_quiet_until = 0;
+    uint32_t step_unsolicited = 0;
+
+    uint8_t stream_phase = STREAM_ENABLE;
+    bool stream_busy = false;         // 試験モードの切り替えの返信待ち
+    uint64_t stream_begin = 0;
+    int16_t stream_value = 0;
+    int16_t stream_delta = STREAM_STEP;
+
+    uint32_t random() {
+      rng ^= rng << 13;
+      rng ^= rng >> 17;
+      rng ^= rng << 5;
+      return rng;
+    }
+
+    // dcm の返信を待っていない (確認の手順中は最後の CMD_PRP に DCM_DSP が返ってくるので、DCM_DSP も待っているとみなす)
+    bool reply_free(uint8_t dcm) const {
+      if (dcm == DCM_DSP && confirm_open) return false;
+      for (std::deque<Pending>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+        if (it->expect == dcm) return false;
+      }
+      return true;
+    }
+
+    void expect(uint8_t dcm, uint8_t count, uint8_t probe, uint64_t sent) {
+      Pending p = {dcm, count, probe, sent, sent + REPLY_TIMEOUT};
+      pending.push_back(p);
+    }
+
+    void request_links(uint64_t now) {
+      uint64_t sent = wire.send(esp_command_frame(CMD_REQ, std::vector<uint8_t>(1, REQ_LNK)), now);
+      expect(DCM_LNK, LINKS, PROBE_LINK, sent);
+    }
+
+    void send_prp(uint8_t command, uint8_t accept, uint64_t at, uint8_t probe) {
+      std::vector<uint8_t> data;
+      data.push_back(command);
+      data.push_back(accept);
+      uint64_t sent = wire.send(esp_command_frame(CMD_PRP, data), at + THINK_TIME);
+      expect(DCM_DSP, 1, probe, sent);
+    }
+
+    void complete(const Pending &p, const Frame &frame) {
+      answered[p.probe]++;
+      // 実機では送信の完了時刻を推定しているので、返信の方が早く見えることがある
+      uint64_t elapsed = frame_time > p.sent ? frame_time - p.sent : 0;
+      switch (p.probe) {
+        case PROBE_LINK:
+          if (phase == PHASE_LINK_BEGIN) {
+            link_begin = link_last;
+            phase = PHASE_RUN;
+            run_begin = frame_time;
+            next_time = frame_time;
+          }
+          else if (phase == PHASE_LINK_END) {
+            link_end = link_last;
+            phase = PHASE_DONE;
+          }
+          return;
+        case PROBE_CONFIRM:
+          latency.add(elapsed);
+          send_prp(CMD_TQS, 0x00, frame_time, PROBE_PRP);
+          return;
+        case PROBE_PRP:
+          confirm_open = false;
+          latency.add(elapsed);
+          return;
+        case PROBE_SCRIPT:
+          script_reply(frame);
+          return;
+        case PROBE_STREAM:
+          stream_reply(frame);
+          return;
+        default:
+          latency.add(elapsed);
+          return;
+      }
+    }
+
+    void timeout(const Pending &p) {
+      dropped[p.probe]++;
+      switch (p.probe) {
+        case PROBE_LINK:
+          if (phase == PHASE_LINK_BEGIN) {
+            phase = PHASE_RUN;
+            run_begin = wire.now();
+            next_time = run_begin;
+          }
+          else if (phase == PHASE_LINK_END) {
+            phase = PHASE_DONE;
+          }
+          return;
+        case PROBE_CONFIRM:
+        case PROBE_PRP:
+          confirm_open = false;
+          return;
+        case PROBE_SCRIPT:
+          script_result(false, "no reply");
+          return;
+        case PROBE_STREAM:
+          stream_failures++;
+          stream_busy = false;
+          if (!run_end) run_end = wire.now();
+          phase = PHASE_DRAIN;
+          return;
+        default:
+          return;
+      }
+    }
+
+    // ---------- 負荷試験 ---------- //
+
+    std::vector<uint8_t> request_frame(uint8_t request = REQ_INI) {
+      return esp_command_frame(CMD_REQ, std::vector<uint8_t>(1, request));
+    }
+
+    // 返信を待っていない種類の要求を順に選ぶ (どれも返信待ちなら NULL)
+    const LoadRequest *pick_request() {
+      for (uint8_t n = 0; n < LOAD_REQUESTS; n++) {
+        const LoadRequest *r = &load_requests[(request_next + n) % LOAD_REQUESTS];
+        if (!reply_free(r->expect)) continue;
+        request_next = (uint8_t)((request_next + n + 1) % LOAD_REQUESTS);
+        return r;
+      }
+      return NULL;
+    }
+
+    // 正しいが返信の無いパケット (試験モードでないサーボへの CMD_TMV は拒否される)
+    std::vector<uint8_t> filler_frame() {
+      filled++;
+      return esp_command_frame(CMD_TMV, int16_bytes(RUD_ID, 0));
+    }
+
+    // 確認が必要で、実行しても何も変えないコマンド (CMD_PRP で拒否する)
+    std::vector<uint8_t> confirm_frame() {
+      std::vector<uint8_t> data;
+      data.push_back(RUD_ID);
+      data.push_back(99);
+      return esp_command_frame(CMD_TQS, data);
+    }
+
+    std::vector<uint8_t> noise(uint8_t max_len) {
+      std::vector<uint8_t> p(1 + random() % max_len);
+      for (size_t i = 0; i < p.size(); i++) p[i] = (uint8_t)random();
+      return p;
+    }
+
+    uint8_t pick_kind() {
+      if (mix_total == 0) return MIX_VALID;
+      uint32_t r = random() % mix_total;
+      for (uint8_t k = 0; k < MIX_KINDS; k++) {
+        if (r < mix[k]) return k;
+        r -= mix[k];
+      }
+      return MIX_VALID;
+    }
+
+    void load_tick(uint64_t now) {
+      if (now >= run_begin + (uint64_t)(seconds * 1e6)) {
+        run_end = now;
+        phase = PHASE_DRAIN;
+        return;
+      }
+      if (rate <= 0) return;
+      uint64_t period = (uint64_t)(1e6 / rate);
+      while (next_time <= now) {
+        load_send(next_time);
+        next_time += period;
+      }
+    }
+
+    void load_send(uint64_t at) {
+      offered++;
+      if (wire.next_free > at + BACKLOG_MAX) {
+        skipped++;
+        return;
+      }
+      uint8_t kind = pick_kind();
+      sent[kind]++;
+      std::vector<uint8_t> p;
+      switch (kind) {
+        case MIX_VALID: {
+            alternate = !alternate;
+            if (alternate && reply_free(DCM_DSP) && reply_free(DCM_PRP)) {
+              confirm_open = true;
+              expect(DCM_PRP, 1, PROBE_CONFIRM, wire.send(confirm_frame(), at));
+              return;
+            }
+            const LoadRequest *r = pick_request();
+            if (r == NULL) wire.send(filler_frame(), at);
+            else expect(r->expect, r->count, PROBE_REQ, wire.send(request_frame(r->request), at));
+            return;
+          }
+        case MIX_CHECKSUM:
+          p = request_frame();
+          p[p.size() - 1] ^= (uint8_t)(1 + random() % 255);
+          break;
+        case MIX_LENGTH:
+          p = esp_command_frame(CMD_LOG, std::vector<uint8_t>());
+          p[ESP_PKT_LENGTH] = (uint8_t)(ESP_PACKET_SIZE + random() % (256 - ESP_PACKET_SIZE));
+          p.resize(ESP_PKT_DATA);
+          break;
+        case MIX_TRUNCATED:
+          p = request_frame();
+          p.resize(2 + random() % (p.size() - 2));
+          break;
+        case MIX_NOISE:
+          p = noise(16);
+          break;
+        case MIX_INTERLEAVED: {
+            // 途中で切れたパケットか雑音のすぐ後に、間を空けずに正しいパケットを続ける
+            if (random() & 1) {
+              p = request_frame();
+              p.resize(2 + random() % (p.size() - 2));
+            }
+            else {
+              p = noise(8);
+            }
+            const LoadRequest *r = pick_request();
+            std::vector<uint8_t> valid = r ? request_frame(r->request) : filler_frame();
+            p.insert(p.end(), valid.begin(), valid.end());
+            uint64_t sent = wire.send(p, at);
+            if (r) expect(r->expect, r->count, PROBE_INTERLEAVED, sent);
+            return;
+          }
+      }
+      wire.send(p, at);
+    }
+
+    // ---------- CMD_TMV の連続送信 ---------- //
+
+    // ラダーの試験モードを mode にする (CMD_TMD を送り、確認パケットを承認する)
+    void stream_mode(uint8_t mode, uint64_t now) {
+      std::vector<uint8_t> data;
+      data.push_back(RUD_ID);
+      data.push_back(mode);
+      expect(DCM_PRP, 1, PROBE_STREAM, wire.send(esp_command_frame(CMD_TMD, data), now));
+      stream_busy = true;
+    }
+
+    void stream_reply(const Frame &frame) {
+      if (esp_command(frame) == DCM_PRP) {
+        send_prp(CMD_TMD, 0x01, frame_time, PROBE_STREAM);
+        return;
+      }
+      stream_busy = false;
+      stream_phase++;
+      if (stream_phase == STREAM_RUN) {
+        stream_begin = frame_time;
+        next_time = frame_time;
+      }
+      if (stream_phase == STREAM_DONE) {
+        stream_end = frame_time;
+        phase = PHASE_DRAIN;
+      }
+    }
+
+    // 目標位置は ±STREAM_AMPLITUDE の三角波 (続けて同じ値にならないので、どの CMD_TMV が書き込まれたか分かる)
+    void stream_send(uint64_t at) {
+      offered++;
+      if (wire.next_free > at + BACKLOG_MAX) {
+        skipped++;
+        return;
+      }
+      if (stream_value + stream_delta > STREAM_AMPLITUDE || stream_value + stream_delta < -STREAM_AMPLITUDE) stream_delta = -stream_delta;
+      stream_value += stream_delta;
+      stream_sent.push_back(std::make_pair(wire.send(esp_command_frame(CMD_TMV, int16_bytes(RUD_ID, stream_value)), at), stream_value));
+    }
+
+    void stream_tick(uint64_t now) {
+      if (stream_busy) return;
+      switch (stream_phase) {
+        case STREAM_ENABLE:
+          stream_mode(1, now);
+          return;
+        case STREAM_RUN: {
+            if (now >= stream_begin + (uint64_t)(seconds * 1e6)) {
+              run_end = now;
+              stream_phase = STREAM_DISABLE;
+              stream_mode(0, now);
+              return;
+            }
+            if (rate <= 0) return;
+            uint64_t period = (uint64_t)(1e6 / rate);
+            while (next_time <= now) {
+              stream_send(next_time);
+              next_time += period;
+            }
+            return;
+          }
+      }
+    }
+
+    // ---------- 確認手順 ---------- //
+
+    void add_step(const char *name, uint8_t command, const std::vector<uint8_t> &data, int16_t expect, uint8_t count = 1,
+                  int8_t prp = -1, int8_t check_offset = -1, uint8_t check_size = 1, int16_t check_value = 0) {
+      ScriptStep s = {name, esp_command_frame(command, data), expect, count, prp, check_offset, check_size, check_value};
+      steps.push_back(s);
+    }
+
+    static std::vector<uint8_t> bytes(uint8_t a) {
+      return std::vector<uint8_t>(1, a);
+    }
+    static std::vector<uint8_t> bytes(uint8_t a, uint8_t b) {
+      std::vector<uint8_t> d(1, a);
+      d.push_back(b);
+      return d;
+    }
+
+    // DCM_DSP のデータの位置 (command_build_all() の並び)
+    enum { DSP_RUD_MIN = 1, DSP_RUD_TEST = 19, DSP_ELE_TORQUE = 25, DSP_ELE_SWEEP = 30 };
+
+    void script_build() {
+      add_step("REQ INI",                 CMD_REQ, bytes(REQ_INI), DCM_DSP, 1, -1, 0, 1, SET_RUD_MIN);
+      add_step("REQ HLT",                 CMD_REQ, bytes(REQ_HLT), DCM_HLT, SERVO_COUNT_MAX);
+      add_step("REQ LNK",                 CMD_REQ, bytes(REQ_LNK), DCM_LNK, LINKS);
+      add_step("REQ BUS",                 CMD_REQ, bytes(REQ_BUS), DCM_BUS, 1);
+      add_step("LOG",                     CMD_LOG, std::vector<uint8_t>(7, 'e'), -1);
+      add_step("SET RUD_MIN -450 accept", CMD_SET, int16_bytes(SET_RUD_MIN, -450), DCM_PRP, 1, 1, DSP_RUD_MIN, 2, -450);
+      add_step("SET RUD_MIN -400 reject", CMD_SET, int16_bytes(SET_RUD_MIN, -400), DCM_PRP, 1, 0, DSP_RUD_MIN, 2, -450);
+      add_step("SET RUD_MIN 0 (invalid)", CMD_SET, int16_bytes(SET_RUD_MIN, 0), -1);
+      add_step("TQS RUD 90 accept",       CMD_TQS, bytes(RUD_ID, 90), DCM_PRP, 1, 1);
+      add_step("TMS ELE 2 accept",        CMD_TMS, bytes(ELE_ID, 2), DCM_PRP, 1, 1, DSP_ELE_TORQUE, 1, 2);
+      add_step("TMS ELE 1 accept",        CMD_TMS, bytes(ELE_ID, 1), DCM_PRP, 1, 1, DSP_ELE_TORQUE, 1, 1);
+      add_step("TMD RUD 1 accept",        CMD_TMD, bytes(RUD_ID, 1), DCM_PRP, 1, 1, DSP_RUD_TEST, 1, 1);
+      add_step("TMV RUD 300",             CMD_TMV, int16_bytes(RUD_ID, 300), -1);
+      add_step("TMD RUD 0 accept",        CMD_TMD, bytes(RUD_ID, 0), DCM_PRP, 1, 1, DSP_RUD_TEST, 1, 0);
+      add_step("TQS RUD 100 accept",      CMD_TQS, bytes(RUD_ID, 100), DCM_PRP, 1, 1);
+      add_step("RBT ELE accept",          CMD_RBT, bytes(ELE_ID), DCM_PRP, 1, 1);
+      add_step("SWP ELE 1 accept",        CMD_SWP, bytes(ELE_ID, 1), DCM_PRP, 1, 1, DSP_ELE_SWEEP, 1, 1);
+      add_step("SET RUD_MIN -500 accept", CMD_SET, int16_bytes(SET_RUD_MIN, -500), DCM_PRP, 1, 1, DSP_RUD_MIN, 2, -500);
+      add_step("PRP without command",     CMD_PRP, bytes(CMD_SET, 1), DCM_DSP, 1, -1, DSP_RUD_MIN, 2, -500);
+      // 壊れたパケットには返信せず、次の正しいパケットから立ち直る
+      add_step("REQ INI bad checksum",    CMD_REQ, bytes(REQ_INI), -1);
+      steps.back().frame.back() ^= 0xFF;
+      add_step("REQ INI after bad frame", CMD_REQ, bytes(REQ_INI), DCM_DSP, 1, -1, 0, 1, SET_RUD_MIN);
+    }
+
+    void script_tick(uint64_t now) {
+      if (step_busy) {
+        if (steps[step].expect < 0 && now >= step_quiet_until) {
+          script_result(unsolicited == step_unsolicited, "unexpected reply");
+        }
+        return;
+      }
+      if (step >= steps.size()) {
+        run_end = now;
+        phase = PHASE_DRAIN;
+        return;
+      }
+      if (now < next_time) return;
+      const ScriptStep &s = steps[step];
+      step_busy = true;
+      step_phase = 0;
+      step_begin = now;
+      uint64_t sent = wire.send(s.frame, now);
+      if (s.expect < 0) {
+        step_quiet_until = sent + SCRIPT_QUIET;
+        step_unsolicited = unsolicited;
+      }
+      else {
+        expect((uint8_t)s.expect, s.count, PROBE_SCRIPT, sent);
+      }
+    }
+
+    void script_reply(const Frame &frame) {
+      const ScriptStep &s = steps[step];
+      if (step_phase == 0 && s.prp >= 0) {
+        // 確認パケットのデータ先頭は確認しているコマンド
+        if (esp_data_len(frame) < 1 || esp_data(frame)[0] != s.frame[ESP_PKT_COMMAND]) {
+          script_result(false, "wrong DCM_PRP");
+          return;
+        }
+        step_phase = 1;
+        send_prp(s.frame[ESP_PKT_COMMAND], (uint8_t)s.prp, frame_time, PROBE_SCRIPT);
+        return;
+      }
+      if (s.check_offset >= 0) {
+        const uint8_t *d = esp_data(frame);
+        int16_t value = s.check_size == 2 ? (int16_t)PacketField<uint16_t, 0>::get(d + s.check_offset) : d[s.check_offset];
+        if (esp_command(frame) != DCM_DSP || esp_data_len(frame) != DSP_DATA_LEN || value != s.check_value) {
+          char detail[48];
+          snprintf(detail, sizeof(detail), "got %d, expected %d", value, s.check_value);
+          script_result(false, detail);
+          return;
+        }
+      }
+      script_result(true, "");
+    }
+
+    void script_result(bool ok, const char *detail) {
+      uint64_t end = steps[step].expect < 0 ? step_quiet_until - SCRIPT_QUIET : frame_time;
+      printf("%-4s %-26s %8.1f ms  %s\n", ok ? "ok" : "FAIL", steps[step].name, (end - step_begin) / 1000.0, ok ? "" : detail);
+      if (!ok) script_failures++;
+      // 失敗した項目の返信がまだ来るかもしれないので、待っているものを捨てる
+      if (!ok) pending.clear();
+      step_busy = false;
+      step++;
+      next_time = wire.now() + SCRIPT_GAP;
+    }
+};
+
+// ---------- シミュレーション ----------------------------------------------------------------- //
+
+// 模擬 ESP: 操舵基板の送信を EspStation に渡し、受信を確かめるたびに届いたバイトを受信バッファに移す
+class SimEsp : public SerialPeer {
+  public:
+    SimWire wire;
+    EspStation station;
+
+    SimEsp(bool script, bool stream, double rate, double seconds, const uint32_t *mix, uint32_t seed)
+      : station(wire, script, stream, rate, seconds, mix, seed) {}
+
+    void received(HardwareSerial &, uint8_t c, uint64_t at) {
+      station.on_byte(c, at);
+    }
+    void poll(HardwareSerial &) {
+      station.tick(sim_now);
+      wire.deliver();
+    }
+};
+
+// 模擬サーボ: メモリマップの書き込みと読み出しに応える (読み出しは SIM_SERVO_REPLY 後に返信する)
+class SimServo : public SerialPeer {
+  public:
+    Samples control_gap[SERVO_COUNT_MAX]; // 目標位置の書き込みの間隔(us)
+    GoalLog goals[SERVO_COUNT_MAX];       // 目標位置の書き込み
+    uint64_t window_begin = 0, window_end = 0;
+
+    SimServo() {
+      for (uint8_t i = 0; i < SERVO_COUNT_MAX; i++) reset(i);
+    }
+
+    void received(HardwareSerial &serial, uint8_t c, uint64_t at) {
+      if (len == 0 && c != SERVO_TX_HEADER_0) return;
+      if (len == 1 && c != SERVO_TX_HEADER_1) {
+        len = c == SERVO_TX_HEADER_0 ? 1 : 0;
+        return;
+      }
+      packet[len++] = c;
+      if (len <= SERVO_PKT_COUNT) return;
+      uint8_t data_len = packet[SERVO_PKT_LENGTH] * packet[SERVO_PKT_COUNT];
+      if (len < servo_packet_len(data_len)) return;
+      len = 0;
+      if (packet[servo_packet_len(data_len) - 1] != checksum(packet, servo_packet_len(data_len) - 1)) return;
+      handle(serial, data_len, at);
+    }
+    void poll(HardwareSerial &) {}
+
+  private:
+    uint8_t packet[64];
+    uint8_t len = 0;
+    uint8_t memory[SERVO_COUNT_MAX][128];
+    uint64_t last_move[SERVO_COUNT_MAX] = {0};
+
+    void reset(uint8_t i) {
+      memset(memory[i], 0, sizeof(memory[i]));
+      memory[i][SERVO_ADDR_MAX_TORQUE] = 100;
+      memory[i][SERVO_ADDR_PRESENT_CURRENT] = 200;
+      memory[i][SERVO_ADDR_PRESENT_TEMPERATURE] = 30;
+      memory[i][SERVO_ADDR_PRESENT_VOLTAGE] = lowByte(740);
+      memory[i][SERVO_ADDR_PRESENT_VOLTAGE + 1] = highByte(740);
+    }
+
+    void handle(HardwareSerial &serial, uint8_t data_len, uint64_t at) {
+      uint8_t id = packet[SERVO_PKT_ID];
+      if (id < 1 || id > SERVO_COUNT_MAX) return;
+      uint8_t *mem = memory[id - 1];
+      uint8_t address = packet[SERVO_PKT_ADDRESS];
+      switch (packet[SERVO_PKT_FLAGS]) {
+        case SERVO_FLAG_WRITE:
+          if (address + data_len > (int)sizeof(memory[0])) return;
+          memcpy(mem + address, packet + SERVO_PKT_DATA, data_len);
+          if (address == SERVO_ADDR_GOAL_POSITION) {
+            memcpy(mem + SERVO_ADDR_PRESENT_POSITION, mem + SERVO_ADDR_GOAL_POSITION, 2);
+            if (last_move[id - 1] && at >= window_begin && at <= window_end) control_gap[id - 1].add(at - last_move[id - 1]);
+            goals[id - 1].push_back(std::make_pair(at, (int16_t)PacketField<uint16_t, SERVO_ADDR_GOAL_POSITION>::get(mem)));
+            last_move[id - 1] = at;
+          }
+          return;
+        case SERVO_FLAG_REBOOT:
+          reset(id - 1);
+          return;
+        case SERVO_FLAG_READ: {
+            uint8_t n = packet[SERVO_PKT_LENGTH];
+            if (address + n > (int)sizeof(memory[0])) return;
+            uint8_t reply[64];
+            reply[0] = SERVO_RX_HEADER_0;
+            reply[1] = SERVO_RX_HEADER_1;
+            reply[SERVO_PKT_ID] = id;
+            reply[SERVO_PKT_FLAGS] = 0;
+            reply[SERVO_PKT_ADDRESS] = address;
+            reply[SERVO_PKT_LENGTH] = n;
+            reply[SERVO_PKT_COUNT] = 1;
+            memcpy(reply + SERVO_PKT_DATA, mem + address, n);
+            reply[servo_packet_len(n) - 1] = checksum(reply, servo_packet_len(n) - 1);
+            uint64_t t = at + SIM_SERVO_REPLY;
+            for (uint8_t i = 0; i < servo_packet_len(n); i++) {
+              t += serial.byte_time;
+              serial.rx.push_back(std::make_pair(t, reply[i]));
+            }
+            return;
+          }
+      }
+    }
+};
+
+// ---------- 結果の表示 ----------------------------------------------------------------------- //
+
+struct Options {
+  bool script = false;
+  bool stream = false;
+  bool verbose = false;
+  const char *device = NULL;
+  std::vector<double> rates;
+  double seconds = 10.0;
+  uint32_t mix[MIX_KINDS] = {70, 5, 5, 5, 5, 10};
+  uint32_t seed = 1;
+};
+
+void print_header() {
+  printf("%6s %6s %5s %6s %5s %5s %5s %7s %7s %5s %7s %7s %7s | %6s %5s %6s %5s %5s | %7s %7s %8s\n",
+         "rate", "sent", "wire%", "reply", "drop", "skip", "fill", "ilv_ok", "ilv_drp", "cmd/s", "p50ms", "p99ms", "maxms",
+         "fw_ok", "csum", "disc", "tmo", "ovf", "ctl_p99", "ctl_max", "loop_max");
+}
+
+void print_row(double rate, const EspStation &s, const EspWire &wire, const SimWire *sim, const SimServo *servo, const Samples *loop_time) {
+  uint32_t sent = 0;
+  for (uint8_t k = 0; k < MIX_KINDS; k++) sent += s.sent[k];
+  uint32_t reply = s.answered[PROBE_REQ] + s.answered[PROBE_CONFIRM] + s.answered[PROBE_PRP];
+  uint32_t drop = s.dropped[PROBE_REQ] + s.dropped[PROBE_CONFIRM] + s.dropped[PROBE_PRP];
+  double duration = (s.run_end - s.run_begin) / 1e6;
+  double wire_util = duration > 0 ? 100.0 * wire.bytes * wire.byte_time / 1e6 / duration : 0.0;
+  printf("%6.1f %6u %5.1f %6u %5u %5u %5u %7u %7u %5.1f %7.1f %7.1f %7.1f | %6u %5u %6u %5u ",
+         rate, sent, wire_util > 100.0 ? 100.0 : wire_util, reply, drop, s.skipped, s.filled,
+         s.answered[PROBE_INTERLEAVED], s.dropped[PROBE_INTERLEAVED], duration > 0 ? (reply + s.answered[PROBE_INTERLEAVED]) / duration : 0.0,
+         s.latency.percentile(50) / 1000.0, s.latency.percentile(99) / 1000.0, s.latency.percentile(100) / 1000.0,
+         (uint16_t)(s.link_end.frames_ok - s.link_begin.frames_ok), (uint16_t)(s.link_end.checksum_fail - s.link_begin.checksum_fail),
+         (uint16_t)(s.link_end.resync_discard - s.link_begin.resync_discard), (uint16_t)(s.link_end.timeouts - s.link_begin.timeouts));
+  if (sim == NULL) {
+    printf("%5s | %7s %7s %8s\n", "-", "-", "-", "-");
+    return;
+  }
+  Samples gap;
+  for (uint8_t i = 0; i < SERVO_COUNT_MAX; i++) gap.values.insert(gap.values.end(), servo->control_gap[i].values.begin(), servo->control_gap[i].values.end());
+  printf("%5u | %7.1f %7.1f %8.1f\n", sim->overflow, gap.percentile(99) / 1000.0, gap.percentile(100) / 1000.0, loop_time->percentile(100) / 1000.0);
+}
+
+void print_stream_header() {
+  printf("%6s %6s %5s %7s %7s %7s %7s %7s %4s | %6s %5s %6s %5s %5s | %7s %7s %8s\n",
+         "rate", "sent", "wire%", "applied", "skipped", "p50ms", "p99ms", "maxms", "last",
+         "fw_ok", "csum", "disc", "tmo", "ovf", "ctl_p99", "ctl_max", "loop_max");
+}
+
+// 送った CMD_TMV と、それがサーボに書き込まれた時刻を突き合わせる
+// 書き込みごとに、その時刻までに届いた CMD_TMV のうち同じ目標位置の最新のものを探す
+// 試験モードを切り替えられなかったか、最後に送った目標位置が書き込まれなければ false
+bool print_stream_row(double rate, const EspStation &s, const EspWire &wire, const SimWire *sim, const SimServo *servo, const Samples *loop_time) {
+  const GoalLog &sent = s.stream_sent;
+  double duration = (s.run_end - s.run_begin) / 1e6;
+  double wire_util = duration > 0 ? 100.0 * wire.bytes * wire.byte_time / 1e6 / duration : 0.0;
+  printf("%6.1f %6u %5.1f ", rate, (unsigned)sent.size(), wire_util > 100.0 ? 100.0 : wire_util);
+  bool ok = s.stream_failures == 0;
+  if (servo == NULL) {
+    printf("%7s %7s %7s %7s %7s %4s | ", "-", "-", "-", "-", "-", "-");
+  }
+  else {
+    const GoalLog &goals = servo->goals[get_index(RUD_ID)];
+    std::vector<bool> applied(sent.size(), false);
+    Samples latency;
+    int16_t last = 0;
+    size_t k = 0;
+    for (size_t w = 0; w < goals.size() && goals[w].first < s.stream_end; w++) {
+      while (k < sent.size() && sent[k].first <= goals[w].first) k++;
+      for (size_t j = k; j-- > 0;) {
+        if (sent[j].second != goals[w].second) continue;
+        if (!applied[j]) latency.add(goals[w].first - sent[j].first);
+        applied[j] = true;
+        break;
+      }
+      last = goals[w].second;
+    }
+    uint32_t count = (uint32_t)std::count(applied.begin(), applied.end(), true);
+    bool last_ok = !sent.empty() && last == sent.back().second;
+    ok = ok && last_ok;
+    printf("%7u %7u %7.1f %7.1f %7.1f %4s | ", count, (uint32_t)sent.size() - count,
+           latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0, latency.percentile(100) / 1000.0,
+           s.stream_failures ? "FAIL" : last_ok ? "ok" : "NG");
+  }
+  printf("%6u %5u %6u %5u ",
+         (uint16_t)(s.link_end.frames_ok - s.link_begin.frames_ok), (uint16_t)(s.link_end.checksum_fail - s.link_begin.checksum_fail),
+         (uint16_t)(s.link_end.resync_discard - s.link_begin.resync_discard), (uint16_t)(s.link_end.timeouts - s.link_begin.timeouts));
+  if (sim == NULL) {
+    printf("%5s | %7s %7s %8s\n", "-", "-", "-", "-");
+    return ok;
+  }
+  Samples gap;
+  for (uint8_t i = 0; i < SERVO_COUNT_MAX; i++) gap.values.insert(gap.values.end(), servo->control_gap[i].values.begin(), servo->control_gap[i].values.end());
+  printf("%5u | %7.1f %7.1f %8.1f\n", sim->overflow, gap.percentile(99) / 1000.0, gap.percentile(100) / 1000.0, loop_time->percentile(100) / 1000.0);
+  return ok;
+}
+
+// ---------- 実行 ----------------------------------------------------------------------------- //
+
+// シミュレーションで1回試す (頻度ごとに fork した子プロセスで呼ぶので、ファームウェアの状態は毎回初期値から始まる)
+int run_sim(const Options &opt, double rate) {
+  // EEPROM は書き込み前の既定角度 (WASA-Control.ino の初期値) にしておく
+  const int16_t angles[6] = { -500, 0, 500, -500, 0, 500};
+  memset(EEPROM.data, 0xFF, sizeof(EEPROM.data));
+  memcpy(EEPROM.data, angles, sizeof(angles));
+  if (opt.verbose) Serial.echo = stdout;
+
+  SimServo servo;
+  SimEsp esp(opt.script, opt.stream, rate, opt.seconds, opt.mix, opt.seed);
+  SERVO_SERIAL.peer = &servo;
+  ESP_SERIAL.peer = &esp;
+  Samples loop_time;
+  uint64_t limit = SETTLE_TIME + (uint64_t)((opt.seconds + 60) * 1e6);
+
+  setup();
+  while (!esp.station.done() && sim_now < limit) {
+    uint64_t begin = sim_now;
+    servo.window_begin = esp.station.run_begin;
+    servo.window_end = esp.station.run_end ? esp.station.run_end : UINT64_MAX;
+    loop();
+    if (esp.station.run_begin && begin >= esp.station.run_begin && !esp.station.run_end) loop_time.add(sim_now - begin);
+    esp.poll(ESP_SERIAL);
+  }
+  if (opt.script) return esp.station.script_failures ? 1 : 0;
+  if (opt.stream) return print_stream_row(rate, esp.station, esp.wire, &esp.wire, &servo, &loop_time) ? 0 : 1;
+  print_row(rate, esp.station, esp.wire, &esp.wire, &servo, &loop_time);
+  return 0;
+}
+
+int tty_open(const char *path) {
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B9600);
+    cfsetospeed(&tio, B9600);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+// 実機で1回試す
+int run_tty(const Options &opt, int fd, double rate) {
+  TtyWire wire(fd);
+  EspStation station(wire, opt.script, opt.stream, rate, opt.seconds, opt.mix, opt.seed);
+  while (!station.done()) {
+    station.tick(wire.now());
+    if (!wire.flush_due()) {
+      perror(opt.device);
+      return 1;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 1) <= 0) continue;
+    uint8_t buf[256];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    uint64_t now = wire.now();
+    for (ssize_t i = 0; i < n; i++) station.on_byte(buf[i], now);
+  }
+  if (opt.script) return station.script_failures ? 1 : 0;
+  if (opt.stream) return print_stream_row(rate, station, wire, NULL, NULL, NULL) ? 0 : 1;
+  print_row(rate, station, wire, NULL, NULL, NULL);
+  return 0;
+}
+
+bool parse_list(const char *s, std::vector<double> &out) {
+  out.clear();
+  while (*s) {
+    char *end;
+    out.push_back(strtod(s, &end));
+    if (end == s) return false;
+    s = *end == ',' ? end + 1 : end;
+  }
+  return !out.empty();
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0) opt.script = true;
+    else if (strcmp(argv[i], "-T") == 0) opt.stream = true;
+    else if (strcmp(argv[i], "-v") == 0) opt.verbose = true;
+    else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) opt.device = argv[++i];
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) ok = parse_list(argv[++i], opt.rates) && ok;
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) opt.seconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) opt.seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      std::vector<double> mix;
+      ok = parse_list(argv[++i], mix) && mix.size() == MIX_KINDS && ok;
+      for (size_t k = 0; k < mix.size() && k < MIX_KINDS; k++) opt.mix[k] = (uint32_t)mix[k];
+    }
+    else ok = false;
+  }
+  if (!ok || (opt.script && opt.stream)) {
+    fprintf(stderr, "usage: %s [-s | -T] [-v] [-d DEVICE] [-r RATE[,RATE...]] [-t seconds] [-m %s,%s,%s,%s,%s,%s] [-x SEED]\n",
+            argv[0], mix_names[0], mix_names[1], mix_names[2], mix_names[3], mix_names[4], mix_names[5]);
+    return 2;
+  }
+  if (opt.rates.empty()) opt.rates.push_back(10.0);
+
+  int fd = -1;
+  if (opt.device != NULL && (fd = tty_open(opt.device)) < 0) return 1;
+  if (opt.script) return fd >= 0 ? run_tty(opt, fd, 0) : run_sim(opt, 0);
+
+  if (opt.stream) print_stream_header();
+  else print_header();
+  int status = 0;
+  for (size_t i = 0; i < opt.rates.size(); i++) {
+    if (fd >= 0) {
+      status |= run_tty(opt, fd, opt.rates[i]);
+      continue;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      int code = run_sim(opt, opt.rates[i]);
+      fflush(stdout);
+      _exit(code);
+    }
+    int child = 1;
+    if (pid < 0 || waitpid(pid, &child, 0) < 0) perror("fork");
+    status |= WIFEXITED(child) ? WEXITSTATUS(child) : 1;
+  }
+  return status;
+}
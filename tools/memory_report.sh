@@ -0,0 +1,38 @@
+#!/bin/sh
+# モジュール(ヘッダーファイル)別の静的 RAM / フラッシュ使用量を表示する
+# スタックの最大使用量は実機の DEBUG_SERIAL 出力 (MEM 行) で確認する
+#
+# 使い方: tools/memory_report.sh [ビルド出力先]
+# arduino-cli と Arduino AVR コア (avr-size, avr-nm) が必要
+
+set -e
+
+cd "$(dirname "$0")/.."
+BUILD_PATH=${1:-build}
+FQBN=arduino:avr:mega
+
+arduino-cli compile --fqbn "$FQBN" --build-path "$BUILD_PATH" . > /dev/null
+ELF="$BUILD_PATH/WASA-Control.ino.elf"
+
+echo "---- 全体 (Mega: SRAM 8192 byte, FLASH 253952 byte) ----"
+avr-size -C --mcu=atmega2560 "$ELF"
+
+echo "---- モジュール別 (byte) ----"
+# avr-nm -l で各シンボルの定義元ファイルを取り、ファイルごとに集計する
+# t/T: フラッシュ(コード)  d/D: RAM + フラッシュ(初期値)  b/B: RAM  r/R: フラッシュ(定数)
+printf "%-24s %8s %8s\n" module RAM FLASH
+avr-nm -t d -l -S --size-sort -C "$ELF" | awk '
+  NF >= 4 {
+    size = $2 + 0; type = $3
+    file = "(core/library)"
+    if (match($0, /[^ \t\/]+\.(h|ino|cpp|c):[0-9]+$/)) {
+      file = substr($0, RSTART, RLENGTH); sub(/:[0-9]+$/, "", file)
+    }
+    if (type ~ /[tTwWrR]/) flash[file] += size
+    if (type ~ /[dD]/) { ram[file] += size; flash[file] += size }
+    if (type ~ /[bB]/) ram[file] += size
+    files[file] = 1
+  }
+  END {
+    for (f in files) printf "%-24s %8d %8d\n", f, ram[f], flash[f]
+  }' | sort -k1,1
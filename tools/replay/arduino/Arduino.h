@@ -0,0 +1,204 @@
+/*
+   tools/replay 用の Arduino 互換層
+   ファームウェアのヘッダーをそのまま PC でビルドするための最小限の定義
+   時刻は仮想時計で、millis()/micros() を呼ぶたびに SIM_TICK_US 進む
+   シリアルの受信はトレースに記録された時刻になると読めるようになり、
+   送信はボーレート分の時間が経つと flush() から戻る
+   peer を設定すると、送信した1バイトごとと受信を確かめるたびに相手側(tools/espsim の模擬 ESP・サーボ)が呼ばれる
+*/
+
+#ifndef REPLAY_ARDUINO_H
+#define REPLAY_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PROGMEM
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define memcpy_P memcpy
+
+#define lowByte(w) ((uint8_t)((w) & 0xFF))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(x, a, b) ((x) < (a) ? (a) : ((x) > (b) ? (b) : (x)))
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+#define HEX 16
+#define A0 54
+#define A1 55
+#define F_CPU 16000000UL
+
+#define SIM_TICK_US 4 // micros() の分解能
+
+// 仮想時計 (us)
+extern uint64_t sim_now;
+
+inline unsigned long micros() {
+  sim_now += SIM_TICK_US;
+  return (unsigned long)(uint32_t)sim_now;
+}
+inline unsigned long millis() {
+  sim_now += SIM_TICK_US;
+  return (unsigned long)(uint32_t)(sim_now / 1000);
+}
+inline void delay(unsigned long ms) {
+  sim_now += (uint64_t)ms * 1000;
+}
+inline void delayMicroseconds(unsigned int us) {
+  sim_now += us;
+}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+// アナログ入力 (時刻順の読み取り値を積んでおく)
+struct SimAnalog {
+  std::deque<std::pair<uint64_t, int16_t> > events;
+  int16_t value = 512;
+};
+extern SimAnalog sim_analog[64];
+
+inline int analogRead(uint8_t pin) {
+  SimAnalog &a = sim_analog[pin & 0x3F];
+  while (!a.events.empty() && a.events.front().first <= sim_now) {
+    a.value = a.events.front().second;
+    a.events.pop_front();
+  }
+  return a.value;
+}
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    size_t write(const uint8_t *data, size_t len) {
+      for (size_t i = 0; i < len; i++) write(data[i]);
+      return len;
+    }
+    size_t print(const char *s) {
+      return write((const uint8_t *)s, strlen(s));
+    }
+    size_t print(const __FlashStringHelper *s) {
+      return print(reinterpret_cast<const char *>(s));
+    }
+    size_t print(char c) {
+      return write((uint8_t)c);
+    }
+    size_t print(long v, int base = DEC) {
+      char buf[24];
+      if (base == HEX) snprintf(buf, sizeof(buf), "%lX", v);
+      else snprintf(buf, sizeof(buf), "%ld", v);
+      return print(buf);
+    }
+    size_t print(unsigned long v, int base = DEC) {
+      char buf[24];
+      snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", v);
+      return print(buf);
+    }
+    size_t print(int v, int base = DEC) {
+      return print((long)v, base);
+    }
+    size_t print(unsigned int v, int base = DEC) {
+      return print((unsigned long)v, base);
+    }
+    size_t print(unsigned char v, int base = DEC) {
+      return print((unsigned long)v, base);
+    }
+    size_t print(double v, int digits = 2) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.*f", digits, v);
+      return print(buf);
+    }
+    size_t println() {
+      return print("\r\n");
+    }
+    template <typename T> size_t println(T v) {
+      size_t n = print(v);
+      return n + println();
+    }
+    template <typename T> size_t println(T v, int f) {
+      size_t n = print(v, f);
+      return n + println();
+    }
+};
+
+class HardwareSerial;
+
+// シリアルの相手側
+class SerialPeer {
+  public:
+    virtual ~SerialPeer() {}
+    // ファームウェアが c を送信した (at: 送信が完了する時刻)
+    virtual void received(HardwareSerial &serial, uint8_t c, uint64_t at) = 0;
+    // ファームウェアが受信データを確かめる直前 (ここで serial.rx に積めば読める)
+    virtual void poll(HardwareSerial &serial) = 0;
+};
+
+// トレースから受信データを流し込み、送信データを溜めるシリアル
+class HardwareSerial : public Print {
+  public:
+    using Print::write;
+    std::deque<std::pair<uint64_t, uint8_t> > rx; // 受信できるようになる時刻とデータ
+    std::vector<uint8_t> tx;                       // 送信されたデータ
+    uint64_t tx_done = 0;                          // 送信が完了する時刻
+    uint32_t byte_time = 1042;                     // 1バイトの送信時間(us)
+    uint16_t tx_buffer = 64;                       // 送信バッファの大きさ (SERIAL_TX_BUFFER_SIZE)
+    FILE *echo = NULL;                             // 送信データの表示先 (デバッグ出力用)
+    SerialPeer *peer = NULL;                       // 相手側 (NULL: トレースの再生)
+
+    void begin(unsigned long baudrate) {
+      byte_time = (uint32_t)(10000000UL / baudrate);
+    }
+    int available() {
+      if (peer) peer->poll(*this);
+      int n = 0;
+      for (size_t i = 0; i < rx.size() && rx[i].first <= sim_now; i++) n++;
+      return n;
+    }
+    int read() {
+      if (peer) peer->poll(*this);
+      if (rx.empty() || rx.front().first > sim_now) return -1;
+      uint8_t c = rx.front().second;
+      rx.pop_front();
+      return c;
+    }
+    int peek() {
+      if (peer) peer->poll(*this);
+      if (rx.empty() || rx.front().first > sim_now) return -1;
+      return rx.front().second;
+    }
+    // 送信バッファが一杯なら、1バイト空くまで待つ (実機の HardwareSerial::write と同じく止まる)
+    size_t write(uint8_t c) {
+      uint64_t queued = (uint64_t)tx_buffer * byte_time;
+      if (tx_done > sim_now + queued) sim_now = tx_done - queued;
+      tx.push_back(c);
+      if (echo) fputc(c, echo);
+      tx_done = (tx_done > sim_now ? tx_done : sim_now) + byte_time;
+      if (peer) peer->received(*this, c, tx_done);
+      return 1;
+    }
+    void flush() {
+      if (tx_done > sim_now) sim_now = tx_done;
+    }
+};
+
+extern HardwareSerial Serial, Serial1, Serial2, Serial3;
+
+#endif
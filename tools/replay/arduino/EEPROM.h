@@ -0,0 +1,38 @@
+#ifndef REPLAY_EEPROM_H
+#define REPLAY_EEPROM_H
+
+#include <Arduino.h>
+
+// ATmega2560 の EEPROM (4KB) をメモリ上に持つ
+// 1バイトの書き込みごとに実機の書き込み時間だけ仮想時計を進める (put() は設定時のみなので進めない)
+struct EEPROMClass {
+  uint8_t data[4096];
+  uint32_t writes = 0;        // 書き込んだバイト数
+  uint32_t write_time = 3300; // 1バイトの書き込み時間(us)
+  template <typename T> T &get(int address, T &t) {
+    memcpy(&t, data + address, sizeof(T));
+    return t;
+  }
+  template <typename T> const T &put(int address, const T &t) {
+    memcpy(data + address, &t, sizeof(T));
+    return t;
+  }
+  uint8_t read(int address) {
+    return data[address];
+  }
+  void write(int address, uint8_t value) {
+    data[address] = value;
+    writes++;
+    sim_now += write_time;
+  }
+  void update(int address, uint8_t value) {
+    if (data[address] != value) write(address, value);
+  }
+  uint16_t length() {
+    return sizeof(data);
+  }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef REPLAY_TONE_H
+#define REPLAY_TONE_H
+
+#include <Arduino.h>
+
+// 音は鳴らさない
+class Tone {
+  public:
+    void begin(uint8_t) {}
+    void play(uint16_t, uint32_t = 0) {}
+    void stop() {}
+    bool isPlaying() {
+      return false;
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+/*
+   シリアル通信記録(トレース)の再生
+   SERIAL_CAPTURE を定義したファームウェアで記録したトレースを、PC 上でビルドしたファームウェアの
+   受信処理・操舵処理にそのまま流す
+   時刻は仮想時計なので実時間よりずっと速く進み、同じトレースからは毎回同じ結果になる
+   EEPROM は記録開始時の内容 (トレースの先頭) から始める
+
+   ビルド (リポジトリのルートで):
+     g++ -std=gnu++11 -O2 -I tools/replay/arduino -o replay tools/replay/replay.cpp
+   使い方:
+     replay [-v] [-t 秒] TRACE
+       -v  ファームウェアのデバッグ出力を表示する
+       -t  トレースの最後のレコードの後に動かし続ける時間(秒, 既定 1)
+*/
+
+#include <chrono> // Arduino.h の min/max マクロより先に読み込む
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "../../WASA-Control.ino"
+
+uint64_t sim_now = 0;
+SimAnalog sim_analog[64];
+HardwareSerial Serial, Serial1, Serial2, Serial3;
+EEPROMClass EEPROM;
+
+HardwareSerial *link_serial(uint8_t link) {
+  switch (link) {
+    case LINK_SERVO:   return &SERVO_SERIAL;
+    case LINK_ESP:     return &ESP_SERIAL;
+    case LINK_SENSORY: return &SENSORY_SERIAL;
+  }
+  return NULL;
+}
+
+const char *link_name(uint8_t link) {
+  switch (link) {
+    case LINK_SERVO:   return "servo";
+    case LINK_ESP:     return "esp";
+    case LINK_SENSORY: return "sensory";
+  }
+  return "analog";
+}
+
+struct Trace {
+  uint32_t records = 0;
+  uint64_t end = 0;                        // 最後のレコードの時刻(us)
+  size_t rx[LINKS] = {0};                  // 記録された受信バイト数
+  size_t analog = 0;                       // 記録された操縦桿の読み取り回数
+  size_t eeprom = 0;                       // 記録された EEPROM のバイト数
+  size_t rx_dropped[LINKS] = {0};          // 受信待ちがあふれて捨てられたバイト数
+  size_t rx_full[LINKS] = {0};             // 受信バッファが満杯だった回数
+  std::vector<uint8_t> tx[LINKS];          // 記録された送信データ
+};
+
+// トレースを読み込み、受信データと操縦桿の値を仮想シリアル・仮想アナログ入力に積む
+bool load_trace(const char *path, Trace &trace) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    perror(path);
+    return false;
+  }
+  std::vector<uint8_t> buf;
+  uint8_t chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) buf.insert(buf.end(), chunk, chunk + n);
+  fclose(fp);
+
+  size_t pos = trace_header_len(buf.data(), buf.size());
+  if (pos == 0) {
+    fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+    return false;
+  }
+  // 記録開始時の EEPROM (記録に無い部分は書き込み前の 0xFF)
+  trace.eeprom = min(pos - TRACE_HEADER_LEN, sizeof(EEPROM.data));
+  memset(EEPROM.data, 0xFF, sizeof(EEPROM.data));
+  memcpy(EEPROM.data, &buf[TRACE_HEADER_LEN], trace.eeprom);
+  uint64_t t = 0;
+  while (pos < buf.size()) {
+    uint8_t tag = buf[pos++];
+    uint64_t elapsed = 0;
+    for (uint8_t shift = 0; ; shift += 7) {
+      if (pos >= buf.size() || shift > 28) {
+        fprintf(stderr, "%s: truncated record at offset %zu\n", path, pos);
+        return true;
+      }
+      uint8_t b = buf[pos++];
+      elapsed |= (uint64_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) break;
+    }
+    t += elapsed;
+    uint8_t len = trace_tag_len(tag);
+    if (pos + len > buf.size()) {
+      fprintf(stderr, "%s: truncated record at offset %zu\n", path, pos);
+      return true;
+    }
+    const uint8_t *data = &buf[pos];
+    pos += len;
+    trace.records++;
+    trace.end = t;
+
+    uint8_t link = trace_tag_link(tag);
+    if (link == LINK_ANALOG && trace_tag_dir(tag) == TRACE_EVENT) {
+      if (len != TRACE_EVENT_LEN || data[1] >= LINKS) continue;
+      if (data[0] == TRACE_EVENT_RX_DROPPED) trace.rx_dropped[data[1]] += data[2];
+      if (data[0] == TRACE_EVENT_RX_FULL)    trace.rx_full[data[1]]++;
+    }
+    else if (link == LINK_ANALOG) {
+      if (len != TRACE_ANALOG_LEN) continue;
+      sim_analog[data[0] & 0x3F].events.push_back(std::make_pair(t, (int16_t)(data[1] | (data[2] << 8))));
+      trace.analog++;
+    }
+    else if (trace_tag_dir(tag) == TRACE_RX) {
+      for (uint8_t i = 0; i < len; i++) link_serial(link)->rx.push_back(std::make_pair(t, data[i]));
+      trace.rx[link] += len;
+    }
+    else {
+      trace.tx[link].insert(trace.tx[link].end(), data, data + len);
+    }
+  }
+  return true;
+}
+
+// 送信データが記録と最初に食い違う位置 (一致すれば -1)
+long first_mismatch(const std::vector<uint8_t> &recorded, const std::vector<uint8_t> &replayed) {
+  size_t n = recorded.size() < replayed.size() ? recorded.size() : replayed.size();
+  for (size_t i = 0; i < n; i++) if (recorded[i] != replayed[i]) return (long)i;
+  if (recorded.size() != replayed.size()) return (long)n;
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  bool verbose = false;
+  double tail = 1.0;
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) verbose = true;
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) tail = atof(argv[++i]);
+    else path = argv[i];
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s [-v] [-t seconds] TRACE\n", argv[0]);
+    return 2;
+  }
+
+  Trace trace;
+  if (!load_trace(path, trace)) return 1;
+  if (verbose) Serial.echo = stdout;
+
+  std::chrono::steady_clock::time_point wall_begin = std::chrono::steady_clock::now();
+  uint64_t end = trace.end + (uint64_t)(tail * 1e6);
+  uint32_t loops = 0;
+  setup();
+  while (sim_now < end) {
+    loop();
+    loops++;
+  }
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_begin).count();
+
+  printf("trace   : %u records, %.3f s, %zu analog samples, %zu EEPROM bytes\n", trace.records, trace.end / 1e6, trace.analog, trace.eeprom);
+  printf("replay  : %u loops, %.3f s simulated in %.3f s (%.0fx real time)\n",
+         loops, sim_now / 1e6, wall, wall > 0 ? sim_now / 1e6 / wall : 0.0);
+  printf("%-8s %10s %10s %10s %8s %12s %12s %s\n", "link", "rx", "rx_unread", "rx_dropped", "rx_full", "tx_recorded", "tx_replayed", "tx_first_mismatch");
+  for (uint8_t link = 0; link < LINKS; link++) {
+    HardwareSerial *serial = link_serial(link);
+    long mismatch = first_mismatch(trace.tx[link], serial->tx);
+    printf("%-8s %10zu %10zu %10zu %8zu %12zu %12zu ", link_name(link), trace.rx[link], serial->rx.size(),
+           trace.rx_dropped[link], trace.rx_full[link], trace.tx[link].size(), serial->tx.size());
+    if (mismatch < 0) printf("-\n");
+    else printf("%ld\n", mismatch);
+  }
+  return 0;
+}
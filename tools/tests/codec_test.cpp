@@ -0,0 +1,691 @@
+/*
+   パケット組み立て・解析処理のホスト上のテスト
+   tools/replay の互換層で PC 上にビルドしたファームウェアに対して
+     - 送信パケットが記録済みの正しいバイト列(ゴールデンフレーム)と一致するか
+     - チェックサムの端の場合 (長さ 0・255、データがすべて 0xFF)
+     - ESP からの受信がゴミ・途中切れのパケットの後に立ち直るか
+   を確かめる
+   -b を付けると各処理の1回あたりの時間(ns)を測る (実機のサイクル数は codec_bench.h)
+
+   ビルドと実行 (リポジトリのルートで):
+     make -C tools/tests
+   使い方:
+     codec_test [-v] [-b]
+       -v  ファームウェアのデバッグ出力を表示する
+       -b  テストの後に実行時間を測る
+*/
+
+#include <chrono> // Arduino.h の min/max マクロより先に読み込む
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "../../WASA-Control.ino"
+
+uint64_t sim_now = 0;
+SimAnalog sim_analog[64];
+HardwareSerial Serial, Serial1, Serial2, Serial3;
+EEPROMClass EEPROM;
+
+#define TEST_DEVICE 0x01 // テストで使う ESP のデバイスID
+
+uint32_t checks = 0;
+uint32_t failures = 0;
+
+void check(bool ok, const char *name, const char *detail = "") {
+  checks++;
+  if (ok) return;
+  failures++;
+  printf("FAIL %s %s\n", name, detail);
+}
+
+void print_bytes(const char *label, const uint8_t *p, size_t len) {
+  printf("  %-8s", label);
+  for (size_t i = 0; i < len; i++) printf(" %02X", p[i]);
+  printf("\n");
+}
+
+// 組み立てたパケット actual がゴールデンフレーム expected と一致するか
+void check_frame(const char *name, const uint8_t *actual, size_t actual_len, const uint8_t *expected, size_t expected_len) {
+  bool ok = actual_len == expected_len && memcmp(actual, expected, expected_len) == 0;
+  check(ok, name);
+  if (ok) return;
+  print_bytes("expected", expected, expected_len);
+  print_bytes("actual", actual, actual_len);
+}
+
+#define CHECK(expr) check((expr), #expr)
+#define CHECK_FRAME(name, actual, actual_len, ...) { \
+    const uint8_t expected[] = {__VA_ARGS__}; \
+    check_frame(name, actual, actual_len, expected, sizeof(expected)); \
+  }
+
+// ESP から bytes が今届いたことにする
+void esp_feed(const uint8_t *bytes, size_t len) {
+  for (size_t i = 0; i < len; i++) ESP_SERIAL.rx.push_back(std::make_pair(sim_now, bytes[i]));
+}
+
+#define ESP_FEED(...) { \
+    const uint8_t bytes[] = {__VA_ARGS__}; \
+    esp_feed(bytes, sizeof(bytes)); \
+  }
+
+// ESP への送信データを取り出す
+std::vector<uint8_t> esp_take() {
+  std::vector<uint8_t> tx;
+  tx.swap(ESP_SERIAL.tx);
+  return tx;
+}
+
+// ---------- 送信パケット ---------------------------------------------------------------------- //
+
+void test_servo_frames() {
+  CHECK_FRAME("servo_build_move(1, 300, 20)", servo_tx_packet, servo_build_move(1, 300, 20),
+              0xFA, 0xAF, 0x01, 0x00, 0x1E, 0x04, 0x01, 0x2C, 0x01, 0x14, 0x00, 0x23);
+  CHECK_FRAME("servo_build_move(2, -450, 100)", servo_tx_packet, servo_build_move(2, (uint16_t) - 450, 100),
+              0xFA, 0xAF, 0x02, 0x00, 0x1E, 0x04, 0x01, 0x3E, 0xFE, 0x64, 0x00, 0xBD);
+  CHECK_FRAME("servo_build_request(2)", servo_tx_packet, servo_build_request(2),
+              0xFA, 0xAF, 0x02, 0x0F, 0x1E, 0x18, 0x00, 0x0B);
+  CHECK_FRAME("servo_build_reboot(2)", servo_tx_packet, servo_build_reboot(2),
+              0xFA, 0xAF, 0x02, 0x20, 0xFF, 0x00, 0x00, 0xDD);
+  CHECK_FRAME("servo_build_torque_value(1, 80)", servo_tx_packet, servo_build_torque_value(1, 80),
+              0xFA, 0xAF, 0x01, 0x00, 0x23, 0x01, 0x01, 0x50, 0x72);
+  CHECK_FRAME("servo_build_torque_mode(2, 2)", servo_tx_packet, servo_build_torque_mode(2, 2),
+              0xFA, 0xAF, 0x02, 0x00, 0x24, 0x01, 0x01, 0x02, 0x24);
+}
+
+// EEPROM が空のとき (舵角は aircraft_config.h の既定値 -500, 0, 500)
+void test_command_build_all() {
+  CHECK_FRAME("command_build_all", esp_tx_packet, command_build_all(),
+              0x8D, 0xD8, 0xFA, 0x00, 0x20,
+              0x01, 0x0C, 0xFE, 0x02, 0x00, 0x00, 0x03, 0xF4, 0x01,
+              0x05, 0x0C, 0xFE, 0x06, 0x00, 0x00, 0x07, 0xF4, 0x01,
+              0x08, 0x00, 0x09, 0x00, 0x0A, 0x01, 0x0B, 0x01, 0x0C, 0x00, 0x00, 0x0D, 0x00, 0x00,
+              0xDF);
+}
+
+// サーボ ID 1 の定期読み出しの返信 (フラグ: 受信パケットエラー)
+const uint8_t servo_info_reply[SERVO_INFO_REPLY_LEN] = {
+  0xFD, 0xDF, 0x01, 0x02, 0x1E, 0x18, 0x01,
+  0x64, 0x00, 0x14, 0x00, 0x00, 0x64, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, // 目標位置 100, 目標時間 20, 最大トルク 100, トルクモード 1
+  0x5F, 0x00, 0x0A, 0x00, 0x1E, 0x00, 0xC8, 0x00, 0x23, 0x00, 0xE4, 0x02, // 現在位置 95, 時間 10, 速度 30, 負荷 200, 温度 35, 電圧 740
+  0x57
+};
+
+void test_sensory_build() {
+  memset(sensory_tx_packet, 0, sizeof(sensory_tx_packet));
+  CHECK(servo_info_reply[SERVO_INFO_REPLY_LEN - 1] == checksum(servo_info_reply, SERVO_INFO_REPLY_LEN - 1));
+  uint8_t *slot = sensory_packet(1);
+  memcpy(servo_rx_packet, servo_info_reply, sizeof(servo_info_reply));
+  servo_decode_info(0, slot);
+  CHECK(servo_status[0].packet_error == 1 && servo_status[0].temp_limit == 0);
+  CHECK(servo_status[0].torque_percentage == 100 && servo_status[0].actual_torque_mode == 1);
+  CHECK(servo_status[0].actual_position == 95 && servo_status[0].load == 200);
+  CHECK(servo_status[0].temperature == 35 && servo_status[0].voltage == 740);
+  CHECK(servo_status[0].est_origin == 95 && servo_status[0].est_rate == 50); // 残り 10 (100ms) で 5 進む
+  SensorySlotEstimate::put(slot, 98);
+  SensorySlotAge::put(slot, 12);
+  CHECK_FRAME("sensory_build", sensory_tx_packet, sensory_build(),
+              0x7C, 0xC7, 0x2E,
+              0x02, 0x64, 0x00, 0x14, 0x00, 0x64, 0x01,
+              0x5F, 0x00, 0x0A, 0x00, 0x1E, 0x00, 0xC8, 0x00, 0x23, 0x00, 0xE4, 0x02, 0x62, 0x00, 0x0C, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+              0x11);
+}
+
+// ELE (ID 2) の統計 負荷 -100〜1200 平均 500 超過 3s, 温度 25〜41 平均 33, 電圧 700〜742 平均 720 下回り 12s
+void test_health_frame() {
+  ServoHealth saved = servo_health[1];
+  ServoHealth &health = servo_health[1];
+  health.load        = {-100, 1200, 500 * HEALTH_EWMA_SCALE, 3};
+  health.temperature = {25, 41, 33 * HEALTH_EWMA_SCALE, 0};
+  health.voltage     = {700, 742, 720 * HEALTH_EWMA_SCALE, 12};
+  health.fail_count = 0x0102;
+  health.reboot_count = 3;
+  health.temp_limit_count = 1;
+  health.temp_alarm_count = 0;
+  health.packet_error_count = 2;
+  command_device = TEST_DEVICE;
+  CHECK_FRAME("command_build_health(1)", esp_tx_packet, command_build_health(1),
+              0x8D, 0xD8, 0x01, 0x02, 0x20,
+              0x02, 0x9C, 0xFF, 0xB0, 0x04, 0xF4, 0x01, 0x03, 0x00,
+              0x19, 0x00, 0x29, 0x00, 0x21, 0x00, 0x00, 0x00,
+              0xBC, 0x02, 0xE6, 0x02, 0xD0, 0x02, 0x0C, 0x00,
+              0x02, 0x01, 0x03, 0x00, 0x01, 0x00, 0x02,
+              0x96);
+  servo_health[1] = saved;
+}
+
+// ESP の系統の集計 (使用率の区間は空)
+void test_link_frame() {
+  LinkStats saved = link_stats[LINK_ESP];
+  LinkStats &stats = link_stats[LINK_ESP];
+  memset(stats.tx_window, 0, sizeof(stats.tx_window));
+  memset(stats.rx_window, 0, sizeof(stats.rx_window));
+  stats.tx_bytes = 0x12345;
+  stats.rx_bytes = 0x678;
+  stats.frames_ok = 300;
+  stats.checksum_fail = 4;
+  stats.resync_discard = 17;
+  stats.timeouts = 2;
+  stats.flush_time = 95;
+  command_device = TEST_DEVICE;
+  CHECK_FRAME("command_build_link(LINK_ESP)", esp_tx_packet, command_build_link(LINK_ESP),
+              0x8D, 0xD8, 0x01, 0x03, 0x19,
+              0x01, 0x00, 0x00, 0x00, 0x00, 0x45, 0x23, 0x01, 0x00, 0x78, 0x06, 0x00, 0x00,
+              0x2C, 0x01, 0x04, 0x00, 0x11, 0x00, 0x02, 0x00, 0x5F, 0x00, 0x00, 0x00,
+              0x66);
+  link_stats[LINK_ESP] = saved;
+}
+
+// 確認が必要なコマンドを送り、確認パケット(DCM_PRP)を確かめてから CMD_PRP で拒否する
+void check_confirm(const char *name, const uint8_t *command, size_t command_len, const uint8_t *expected, size_t expected_len) {
+  esp_take();
+  esp_feed(command, command_len);
+  command_handle();
+  std::vector<uint8_t> tx = esp_take();
+  check_frame(name, tx.data(), tx.size(), expected, expected_len);
+  const uint8_t reject[] = {0x8F, 0xF8, TEST_DEVICE, CMD_PRP, 0x02, command[ESP_PKT_COMMAND], 0x00, 0x00};
+  uint8_t frame[sizeof(reject)];
+  memcpy(frame, reject, sizeof(reject));
+  frame[sizeof(frame) - 1] = checksum(frame, sizeof(frame) - 1);
+  esp_feed(frame, sizeof(frame));
+  command_handle();
+  check(!confirm_wait, name, "confirm still pending after CMD_PRP");
+  esp_take();
+}
+
+#define CHECK_CONFIRM(name, command, ...) { \
+    const uint8_t expected[] = {__VA_ARGS__}; \
+    check_confirm(name, command, sizeof(command), expected, sizeof(expected)); \
+  }
+
+void test_confirm_frames() {
+  const uint8_t set[] = {0x8F, 0xF8, 0x01, 0x01, 0x03, 0x03, 0x58, 0x02, 0x5A}; // ラダー最大 500 → 600
+  CHECK_CONFIRM("DCM_PRP CMD_SET", set, 0x8D, 0xD8, 0x01, 0x01, 0x06, 0x01, 0x03, 0xF4, 0x01, 0x58, 0x02, 0xAB);
+  const uint8_t rbt[] = {0x8F, 0xF8, 0x01, 0x03, 0x01, 0x02, 0x01};             // ID 2 を再起動
+  CHECK_CONFIRM("DCM_PRP CMD_RBT", rbt, 0x8D, 0xD8, 0x01, 0x01, 0x02, 0x03, 0x02, 0x03);
+  const uint8_t tqs[] = {0x8F, 0xF8, 0x01, 0x04, 0x02, 0x01, 0x50, 0x56};       // ID 1 のトルク 100% → 80%
+  CHECK_CONFIRM("DCM_PRP CMD_TQS", tqs, 0x8D, 0xD8, 0x01, 0x01, 0x04, 0x04, 0x01, 0x64, 0x50, 0x35);
+  const uint8_t tms[] = {0x8F, 0xF8, 0x01, 0x05, 0x02, 0x02, 0x02, 0x06};       // ID 2 のトルクモード ON → BREAK
+  CHECK_CONFIRM("DCM_PRP CMD_TMS", tms, 0x8D, 0xD8, 0x01, 0x01, 0x04, 0x05, 0x02, 0x01, 0x02, 0x00);
+  const uint8_t tmd[] = {0x8F, 0xF8, 0x01, 0x06, 0x02, 0x01, 0x01, 0x05};       // ID 1 のテストモード OFF → ON
+  CHECK_CONFIRM("DCM_PRP CMD_TMD", tmd, 0x8D, 0xD8, 0x01, 0x01, 0x04, 0x06, 0x01, 0x00, 0x01, 0x02);
+  const uint8_t swp[] = {0x8F, 0xF8, 0x01, 0x08, 0x02, 0x02, 0x02, 0x0B};       // ID 2 の高速試験動作
+  CHECK_CONFIRM("DCM_PRP CMD_SWP", swp, 0x8D, 0xD8, 0x01, 0x01, 0x03, 0x08, 0x02, 0x02, 0x0B);
+  // 拒否したので何も変わっていない
+  CHECK(servo_info[0].val_threshold[MAX] == 500);
+  CHECK(servo_info[1].torque_mode == 1);
+  CHECK(servo_info[0].test_mode == 0);
+  CHECK(servo_info[1].sweep_mode == 0);
+}
+
+// データ長が足りないコマンドは古い受信データを読まずに捨てる
+void test_short_commands() {
+  esp_take();
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_TQS, 0x01, 0x01, 0x04 ^ TEST_DEVICE ^ 0x01 ^ 0x01); // トルク% が無い
+  command_handle();
+  CHECK(esp_take().empty() && !confirm_wait);
+
+  for (uint8_t i = 0; i < BUS_SLOTS; i++) bus_slot[i].pending = false;
+  const uint8_t rbt[] = {0x8F, 0xF8, 0x01, 0x03, 0x01, 0x02, 0x01};             // ID 2 を再起動
+  esp_feed(rbt, sizeof(rbt));
+  command_handle();
+  esp_take();
+  CHECK(confirm_wait);
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_PRP, 0x01, CMD_RBT, TEST_DEVICE ^ CMD_PRP ^ 0x01 ^ CMD_RBT); // 承認/拒否が無い
+  command_handle();
+  CHECK(esp_take().empty());
+  CHECK(confirm_wait);                                   // 確認待ちのまま
+  CHECK(!servo_bus_pending(BUS_MAINTENANCE, 2));         // 再起動していない
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_PRP, 0x02, CMD_RBT, 0x00, TEST_DEVICE ^ CMD_PRP ^ 0x02 ^ CMD_RBT);
+  command_handle();
+  CHECK(!confirm_wait);
+  CHECK(!servo_bus_pending(BUS_MAINTENANCE, 2));
+  esp_take();
+}
+
+// ---------- チェックサム ---------------------------------------------------------------------- //
+
+void test_checksum() {
+  uint8_t ff[255];
+  memset(ff, 0xFF, sizeof(ff));
+  CHECK(checksum(ff, 0) == 0x00);   // ヘッダーより短い
+  CHECK(checksum(ff, 2) == 0x00);   // ヘッダーだけ
+  CHECK(checksum(ff, 3) == 0xFF);
+  CHECK(checksum(ff, 4) == 0x00);
+  CHECK(checksum(ff, 255) == 0xFF); // 253 バイトの 0xFF
+  uint8_t ramp[255];
+  uint8_t sum = 0;
+  for (uint16_t i = 0; i < sizeof(ramp); i++) {
+    ramp[i] = (uint8_t)i;
+    if (i >= 2) sum ^= (uint8_t)i;
+  }
+  CHECK(checksum(ramp, 255) == sum);
+  // チェックサムが 0xFF になるパケットとチェックサムを含めた XOR が 0 になること
+  uint8_t packet[8] = {0xFA, 0xAF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00};
+  packet[7] = checksum(packet, 7);
+  CHECK(packet[7] == 0xFF);
+  CHECK(checksum(packet, 8) == 0x00);
+}
+
+// 送信間隔で回線の使用率が約50%に収まり、送信は前のフレームの送信完了を待たない
+// 操舵の合間ごとに送信を試みるので、ループ1周(操舵5回分)より短い送信間隔で送られる
+void test_sensory_link() {
+  CHECK(SENSORY_FRAME_TIME * 2 <= cooldown);
+  SENSORY_SERIAL.flush();
+  SENSORY_SERIAL.tx.clear();
+  sim_now += ((uint64_t)cooldown + 1) * 1000;
+  sensory_transmit();
+  CHECK(SENSORY_SERIAL.tx.size() == SENSORY_PACKET_LEN);
+  sensory_transmit(); // 送信間隔内は送らない
+  CHECK(SENSORY_SERIAL.tx.size() == SENSORY_PACKET_LEN);
+  sim_now += ((uint64_t)cooldown + 1) * 1000;
+  uint64_t begin = sim_now;
+  sensory_transmit();
+  CHECK(SENSORY_SERIAL.tx.size() == 2 * SENSORY_PACKET_LEN);
+  CHECK(sim_now - begin < 1000); // 送信の完了を待たない
+
+  SENSORY_SERIAL.tx.clear();
+  uint64_t end = sim_now + 1000000;
+  while (sim_now < end) loop();
+  size_t frames = SENSORY_SERIAL.tx.size() / SENSORY_PACKET_LEN;
+  CHECK(frames >= 1000 / (cooldown + SERVO_TIMEOUT_MAX / 1000) - 1);
+  SENSORY_SERIAL.flush();
+  SENSORY_SERIAL.tx.clear();
+}
+
+// ---------- サーボの返信待ち時間 ------------------------------------------------------------ //
+
+// 返信が無いたびに待ち時間が倍になり、返信があれば推定値に戻る
+void test_reply_timeout() {
+  ServoStatus saved = servo_status[1];
+  servo_status[1].rtt_mean = 0;
+  servo_status[1].fail_count = 0;
+  CHECK(servo_reply_timeout(1) == SERVO_TIMEOUT_MAX);      // 推定値が無い
+  servo_status[1].rtt_mean = 1000;
+  servo_status[1].rtt_dev = 100;
+  uint32_t base = 1000 + 4 * 100 + SERVO_BYTE_TIME;
+  CHECK(servo_reply_timeout(1) == base);
+  servo_status[1].fail_count = 1;
+  CHECK(servo_reply_timeout(1) == 2 * base);
+  servo_status[1].fail_count = 2;
+  CHECK(servo_reply_timeout(1) == 4 * base);
+  servo_status[1].fail_count = 3;
+  CHECK(servo_reply_timeout(1) == SERVO_TIMEOUT_MAX);
+  servo_status[1].fail_count = 200;
+  CHECK(servo_reply_timeout(1) == SERVO_TIMEOUT_MAX);
+  servo_status[1] = saved;
+}
+
+// 返信を1回取りこぼしただけでは再起動せず、SERVO_LOST_FAILS 回続いたら再起動する
+void test_reply_lost() {
+  ServoStatus saved = servo_status[1];
+  for (uint8_t i = 0; i < BUS_SLOTS; i++) bus_slot[i].pending = false;
+  servo_status[1].fail_count = 0;
+  servo_status[1].actual_torque_mode = servo_info[1].torque_mode;
+  servo_receive_info(1, sensory_packet(servo_info[1].id), false);
+  servo_maintain();
+  CHECK(servo_status[1].actual_torque_mode == servo_info[1].torque_mode);
+  CHECK(!servo_bus_pending(BUS_MAINTENANCE, servo_info[1].id));
+  for (uint8_t n = 1; n < SERVO_LOST_FAILS; n++) servo_receive_info(1, sensory_packet(servo_info[1].id), false);
+  servo_maintain();
+  CHECK(servo_status[1].actual_torque_mode == 0);
+  CHECK(servo_bus_pending(BUS_MAINTENANCE, servo_info[1].id));
+  for (uint8_t i = 0; i < BUS_SLOTS; i++) bus_slot[i].pending = false;
+  servo_status[1] = saved;
+}
+
+// ---------- サーボからの受信 ----------------------------------------------------------------- //
+
+// サーボから bytes が今届いたことにする
+void servo_feed(const uint8_t *bytes, size_t len) {
+  for (size_t i = 0; i < len; i++) SERVO_SERIAL.rx.push_back(std::make_pair(sim_now, bytes[i]));
+}
+
+// ヘッダーの前のゴミを捨てて受信し、チェックサム誤り・途中で切れた返信は受け付けない
+void test_servo_receive() {
+  ServoStatus saved = servo_status[0];
+  LinkStats before;
+  SERVO_SERIAL.rx.clear();
+
+  before = link_stats[LINK_SERVO];
+  const uint8_t garbage[] = {0x12, 0xDF, 0xFA};
+  servo_feed(garbage, sizeof(garbage));
+  servo_feed(servo_info_reply, sizeof(servo_info_reply));
+  CHECK(servo_receive_data(0, SERVO_INFO_LEN));
+  CHECK(memcmp(servo_rx_packet, servo_info_reply, sizeof(servo_info_reply)) == 0);
+  CHECK(link_stats[LINK_SERVO].resync_discard - before.resync_discard == sizeof(garbage));
+  CHECK(link_stats[LINK_SERVO].frames_ok - before.frames_ok == 1);
+
+  before = link_stats[LINK_SERVO];
+  uint8_t corrupt[SERVO_INFO_REPLY_LEN];
+  memcpy(corrupt, servo_info_reply, sizeof(corrupt));
+  corrupt[SERVO_PKT_DATA] ^= 0x01;
+  servo_feed(corrupt, sizeof(corrupt));
+  CHECK(!servo_receive_data(0, SERVO_INFO_LEN));
+  CHECK(link_stats[LINK_SERVO].checksum_fail - before.checksum_fail == 1);
+
+  before = link_stats[LINK_SERVO];
+  servo_feed(servo_info_reply, SERVO_INFO_REPLY_LEN - 5);
+  CHECK(!servo_receive_data(0, SERVO_INFO_LEN));
+  CHECK(link_stats[LINK_SERVO].timeouts - before.timeouts == 1);
+  CHECK(SERVO_SERIAL.available() == 0);
+
+  // 次の返信は受信できる
+  servo_feed(servo_info_reply, sizeof(servo_info_reply));
+  CHECK(servo_receive_data(0, SERVO_INFO_LEN));
+
+  // 返信が無い
+  before = link_stats[LINK_SERVO];
+  CHECK(!servo_receive_data(0, SERVO_INFO_LEN));
+  CHECK(link_stats[LINK_SERVO].timeouts - before.timeouts == 1);
+  servo_status[0] = saved;
+}
+
+// ---------- ESP からの受信 -------------------------------------------------------------------- //
+
+// 受信待ちの ESP_SERIAL を空にする
+void esp_drain() {
+  sim_now += 20000;
+  while (ESP_SERIAL.read() >= 0) {}
+  confirm_wait = false;
+}
+
+void test_command_receive() {
+  const uint8_t req_ini[] = {0x8F, 0xF8, TEST_DEVICE, CMD_REQ, 0x01, REQ_INI, 0x03};
+  LinkStats before;
+
+  // ヘッダーの前のゴミを捨てて受信する
+  esp_drain();
+  before = link_stats[LINK_ESP];
+  ESP_FEED(0x00, 0x12, 0xFD, 0x8D, 0xF8);
+  esp_feed(req_ini, sizeof(req_ini));
+  CHECK(command_receive());
+  CHECK(command_id == CMD_REQ && command_data_len == 1 && esp_rx_packet[ESP_PKT_DATA] == REQ_INI);
+  CHECK(link_stats[LINK_ESP].resync_discard - before.resync_discard == 5);
+  CHECK(link_stats[LINK_ESP].frames_ok - before.frames_ok == 1);
+
+  // ゴミだけならヘッダー待ちでタイムアウトする
+  esp_drain();
+  before = link_stats[LINK_ESP];
+  ESP_FEED(0x01, 0x02, 0x03);
+  CHECK(!command_receive());
+  CHECK(link_stats[LINK_ESP].timeouts - before.timeouts == 1);
+  CHECK(ESP_SERIAL.available() == 0);
+
+  // 途中で切れたパケットはタイムアウトし、次のパケットは受信できる
+  esp_drain();
+  before = link_stats[LINK_ESP];
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_REQ, 0x01);
+  CHECK(!command_receive());
+  CHECK(link_stats[LINK_ESP].timeouts - before.timeouts == 1);
+  esp_feed(req_ini, sizeof(req_ini));
+  CHECK(command_receive());
+  CHECK(command_id == CMD_REQ);
+
+  // ヘッダーの途中で切れた場合も同じ
+  esp_drain();
+  ESP_FEED(0x8F);
+  CHECK(!command_receive());
+  esp_feed(req_ini, sizeof(req_ini));
+  CHECK(command_receive());
+
+  // 途中で切れたパケットのすぐ後に次のパケットが続くと、そのパケットは失われるが、さらに次のパケットで立ち直る
+  esp_drain();
+  before = link_stats[LINK_ESP];
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_REQ, 0x01);
+  esp_feed(req_ini, sizeof(req_ini));
+  esp_feed(req_ini, sizeof(req_ini));
+  uint8_t received = 0;
+  for (uint8_t n = 0; n < 4; n++) if (command_receive()) received++;
+  CHECK(received == 1);
+  CHECK(link_stats[LINK_ESP].checksum_fail - before.checksum_fail == 1);
+  CHECK(ESP_SERIAL.available() == 0);
+
+  // チェックサム誤り
+  esp_drain();
+  before = link_stats[LINK_ESP];
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_REQ, 0x01, REQ_INI, 0x04);
+  CHECK(!command_receive());
+  CHECK(link_stats[LINK_ESP].checksum_fail - before.checksum_fail == 1);
+
+  // 受信バッファに収まらないデータ長は読まずに捨て、後ろのパケットで立ち直る
+  esp_drain();
+  before = link_stats[LINK_ESP];
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_LOG, 0xFF);
+  esp_feed(req_ini, sizeof(req_ini));
+  CHECK(!command_receive());
+  CHECK(link_stats[LINK_ESP].checksum_fail - before.checksum_fail == 1);
+  CHECK(command_receive());
+  CHECK(command_id == CMD_REQ);
+
+  // CMD_LOG の文字列は 122 文字まで受け付ける
+  const uint8_t log_max = ESP_PACKET_SIZE - esp_packet_len(0);
+  CHECK(log_max == 122);
+  for (uint8_t len = log_max; len <= log_max + 1; len++) {
+    esp_drain();
+    std::vector<uint8_t> log(esp_packet_len(len), 'e');
+    log[0] = 0x8F;
+    log[1] = 0xF8;
+    log[ESP_PKT_DEVICE] = TEST_DEVICE;
+    log[ESP_PKT_COMMAND] = CMD_LOG;
+    log[ESP_PKT_LENGTH] = len;
+    log.back() = checksum(log.data(), log.size() - 1);
+    esp_feed(log.data(), log.size());
+    check(command_receive() == (len == log_max), "CMD_LOG length limit");
+  }
+
+  // command_handle() はゴミの後のコマンドも処理する
+  esp_drain();
+  esp_take();
+  ESP_FEED(0x55, 0xAA, 0x8F);
+  esp_feed(req_ini, sizeof(req_ini));
+  command_handle();
+  std::vector<uint8_t> tx = esp_take();
+  CHECK(tx.size() == EspPacket<DSP_DATA_LEN>::length && tx[ESP_PKT_COMMAND] == DCM_DSP);
+  esp_drain();
+}
+
+// ---------- 集計の読み出し ------------------------------------------------------------------- //
+
+// 制御ループを回した後の REQ_BUS の応答 (サーボは返信しないので読み出しはタイムアウトする)
+void test_bus_report() {
+  esp_drain();
+  uint64_t end = sim_now + 1000000;
+  while (sim_now < end) {
+    loop();
+    for (uint8_t i = 0; i < SERVO_COUNT_MAX; i++) { // 読み出し間隔が伸びて集計区間から読み出しが外れないようにする
+      servo_status[i].fail_count = 0;
+      servo_status[i].request_interval = REQUEST_COOLDOWN;
+    }
+  }
+  esp_take();
+  ESP_FEED(0x8F, 0xF8, TEST_DEVICE, CMD_REQ, 0x01, REQ_BUS, 0x04 ^ TEST_DEVICE ^ CMD_REQ ^ 0x01);
+  command_handle();
+  std::vector<uint8_t> tx = esp_take();
+  CHECK(tx.size() == EspPacket<BUS_DATA_LEN>::length);
+  if (tx.size() != EspPacket<BUS_DATA_LEN>::length) return;
+  CHECK(tx[ESP_PKT_DEVICE] == TEST_DEVICE && tx[ESP_PKT_COMMAND] == DCM_BUS && tx[ESP_PKT_LENGTH] == BUS_DATA_LEN);
+  CHECK(tx.back() == checksum(tx.data(), tx.size() - 1));
+  const uint8_t *data = tx.data() + ESP_PKT_DATA;
+  uint16_t window = PacketField<uint16_t, BUS_WINDOW>::get(data);
+  CHECK(window >= DEBUG_COOLDOWN - 1 && window < 2 * DEBUG_COOLDOWN); // 区切りは millis() で判定するので 1ms 未満短くなりうる
+  uint16_t control = PacketField<uint16_t, BUS_STATS + BUS_CONTROL * BUS_STAT_LEN + BUS_STAT_UTIL>::get(data);
+  uint16_t telemetry = PacketField<uint16_t, BUS_STATS + BUS_TELEMETRY * BUS_STAT_LEN + BUS_STAT_UTIL>::get(data);
+  CHECK(control > 0 && control <= 1000);
+  CHECK(telemetry > 0 && control + telemetry <= 1000);
+}
+
+// ---------- 舵面の設定 ----------------------------------------------------------------------- //
+
+// サーボID の INDEX は aircraft[] から作った表で引く
+void test_servo_ids() {
+  for (uint8_t i = 0; i < AIRCRAFT_SURFACES; i++) CHECK(get_index(aircraft[i].id) == i);
+  CHECK(get_index(0) == 0xFF);
+  CHECK(get_index(SENSORY_SLOT_COUNT + 1) == 0xFF);
+  CHECK(get_index(0xFF) == 0xFF);
+  CHECK(set_target(RUD_ID, MIN) == SET_RUD_MIN && set_target(ELE_ID, MAX) == SET_ELE_MAX);
+}
+
+// EEPROM の舵角 stored を servo_angle_load() で読み込み、使う値と EEPROM に残る値を確かめる
+bool angle_load_is(const int16_t *stored, const int16_t *kept, const int16_t *eeprom) {
+  EEPROM.put(0, stored[MIN]);
+  EEPROM.put(2, stored[NEU]);
+  EEPROM.put(4, stored[MAX]);
+  servo_angle_load(0, -500, 0, 500);
+  int16_t after[3];
+  for (uint8_t type = MIN; type <= MAX; type++) EEPROM.get(type * 2, after[type]);
+  return memcmp(servo_info[0].val_threshold, kept, sizeof(after)) == 0 && memcmp(after, eeprom, sizeof(after)) == 0;
+}
+
+// ずらした値が範囲内のときだけ EEPROM に書き戻し、既定値に戻すときは EEPROM を変えない
+void test_angle_load() {
+  int16_t saved[3];
+  memcpy(saved, servo_info[0].val_threshold, sizeof(saved));
+  uint8_t eeprom[6];
+  memcpy(eeprom, EEPROM.data, sizeof(eeprom));
+
+  const int16_t valid[3] = {-300, 0, 300};
+  CHECK(angle_load_is(valid, valid, valid));
+  const int16_t equal[3] = {0, 0, 300}, nudged[3] = {-1, 0, 300};
+  CHECK(angle_load_is(equal, nudged, nudged));
+  const int16_t high[3] = {-300, 1500, 1500}, defaults[3] = {-500, 0, 500};
+  CHECK(angle_load_is(high, defaults, high));     // MAX をずらすと範囲外
+  const int16_t blank[3] = {-1, -1, -1};
+  CHECK(angle_load_is(blank, defaults, blank));
+
+  memcpy(EEPROM.data, eeprom, sizeof(eeprom));
+  memcpy(servo_info[0].val_threshold, saved, sizeof(saved));
+}
+
+// ---------- 健康状態の統計 ------------------------------------------------------------------- //
+
+// 書き戻した統計の写しが EEPROM にあるか
+bool health_eeprom_is(const ServoHealth *image) {
+  return memcmp(EEPROM.data + HEALTH_EEPROM_ADDR + 1, image, sizeof(health_image)) == 0;
+}
+
+// 書き戻し中の servo_health_save() を最後まで呼ぶ
+void health_save_finish() {
+  for (uint16_t n = 0; n < sizeof(health_image) && health_save_pos < sizeof(health_image); n++) servo_health_save();
+}
+
+// 意味のある変化があったときだけ書き戻し、書き戻し中の更新は次の書き戻しに回す
+// 1回の servo_health_save() で書き込むのは1バイトまで
+void test_health_save() {
+  sim_now += (HEALTH_SAVE_INTERVAL + 1) * 1000;
+  servo_health_save(); // それまでの読み出し分を書き戻しておく
+  health_save_finish();
+  CHECK(health_eeprom_is(servo_health));
+  sim_now += (HEALTH_SAVE_INTERVAL + 1) * 1000;
+  servo_health_save();
+  CHECK(health_save_pos == sizeof(health_image)); // 変化なし
+  servo_health[0].load.ewma = health_image[0].load.ewma + (health_save_delta[0] - 1) * HEALTH_EWMA_SCALE;
+  servo_health_save();
+  CHECK(health_save_pos == sizeof(health_image)); // 指数移動平均の小さな変化では書き戻さない
+
+  servo_health[0].temperature.ewma = health_image[0].temperature.ewma + health_save_delta[1] * HEALTH_EWMA_SCALE;
+  ServoHealth saved[SERVO_COUNT_MAX];
+  memcpy(saved, servo_health, sizeof(saved));
+  uint32_t writes = EEPROM.writes;
+  servo_health_save();
+  CHECK(EEPROM.writes == writes + 1); // 変わったバイトまで読み飛ばし、1バイトだけ書く
+  CHECK(health_save_pos > 0 && health_save_pos < sizeof(health_image));
+  servo_health_save();
+  CHECK(EEPROM.writes <= writes + 2);
+  servo_health[1].fail_count++; // 書き戻し中の更新
+  health_save_finish();
+  CHECK(health_eeprom_is(saved));
+  servo_health_save();
+  CHECK(health_save_pos == sizeof(health_image)); // 書き戻したばかりなので次は間隔を空ける
+  sim_now += (HEALTH_SAVE_INTERVAL + 1) * 1000;
+  health_save_finish();
+  servo_health_save();
+  health_save_finish();
+  CHECK(health_eeprom_is(servo_health));
+}
+
+// 再起動は積んだときではなく送信したときに数える
+void test_health_reboot() {
+  uint16_t count = servo_health[1].reboot_count;
+  servo_reboot(servo_info[1].id);
+  servo_reboot(servo_info[1].id); // 未送信の再起動は上書きされる
+  CHECK(servo_health[1].reboot_count == count);
+  servo_bus_service();
+  CHECK(servo_health[1].reboot_count == count + 1);
+  sim_now += 40000;
+}
+
+// ---------- 実行時間 ------------------------------------------------------------------------- //
+
+#define BENCH_LOOPS 1000000
+
+volatile uint8_t bench_sink = 0;
+
+#define BENCH_RUN(name, expr) { \
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now(); \
+    for (uint32_t n = 0; n < BENCH_LOOPS; n++) bench_sink ^= (uint8_t)(expr); \
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / BENCH_LOOPS; \
+    printf("%-24s %8.1f ns\n", name, ns); \
+  }
+
+void bench() {
+  printf("---- codec bench (host) ----\n");
+  BENCH_RUN("checksum(32)",            checksum(servo_rx_packet, 32));
+  BENCH_RUN("servo_build_move",        servo_build_move((uint8_t)n, (uint16_t)n, 20));
+  BENCH_RUN("servo_build_request",     servo_build_request((uint8_t)n));
+  BENCH_RUN("servo_build_torque_mode", servo_build_torque_mode((uint8_t)n, 1));
+  memcpy(servo_rx_packet, servo_info_reply, sizeof(servo_info_reply));
+  BENCH_RUN("servo_check_packet",      servo_check_packet(SERVO_INFO_LEN));
+  BENCH_RUN("servo_decode_info",       (servo_decode_info(0, sensory_packet(servo_info[0].id)), 0));
+  BENCH_RUN("sensory_build",           sensory_build());
+  BENCH_RUN("command_build_all",       command_build_all());
+  // 試験モードでないサーボへの CMD_TMV (コマンド表を引いて検査で拒否されるまで)
+  servo_info[0].test_mode = 0;
+  command_id = CMD_TMV;
+  command_data_len = 3;
+  esp_rx_packet[ESP_PKT_DATA] = servo_info[0].id;
+  esp_rx_packet[ESP_PKT_DATA + 1] = lowByte(300);
+  esp_rx_packet[ESP_PKT_DATA + 2] = highByte(300);
+  BENCH_RUN("command_interpret",       (command_interpret(), 0));
+}
+
+int main(int argc, char **argv) {
+  bool run_bench = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) Serial.echo = stdout;
+    else if (strcmp(argv[i], "-b") == 0) run_bench = true;
+    else {
+      fprintf(stderr, "usage: %s [-v] [-b]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  memset(EEPROM.data, 0xFF, sizeof(EEPROM.data)); // 書き込み前の EEPROM
+  setup();
+  esp_take();
+
+  test_servo_frames();
+  test_command_build_all();
+  test_sensory_build();
+  test_sensory_link();
+  test_health_frame();
+  test_link_frame();
+  test_confirm_frames();
+  test_short_commands();
+  test_checksum();
+  test_reply_timeout();
+  test_reply_lost();
+  test_servo_receive();
+  test_command_receive();
+  test_bus_report();
+  test_servo_ids();
+  test_angle_load();
+  test_health_save();
+  test_health_reboot();
+
+  printf("codec_test: %u checks, %u failed\n", checks, failures);
+  if (run_bench) bench();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,300 @@
+/*
+   地上局ツール (tools/decode) のホスト上のテスト
+     - FrameParser に任意の区切りでバイト列を渡しても同じパケットが取り出せるか
+     - ゴミ・チェックサム誤りの後に立ち直るか、最後の途中で切れたパケットを捨てるか
+     - 旧版(19 byte)と新版(23 byte)のスロットの計測基板パケットが混ざっても読めるか
+     - 列ごとのバイナリの出力が CSV と同じ値になるか (decode の main() をそのまま呼ぶ)
+   を確かめる
+
+   ビルドと実行 (リポジトリのルートで):
+     make -C tools/tests
+*/
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define main decode_main
+#include "../decode/decode.cpp"
+#undef main
+
+uint32_t checks = 0;
+uint32_t failures = 0;
+
+void check(bool ok, const char *name, const char *detail = "") {
+  checks++;
+  if (ok) return;
+  failures++;
+  printf("FAIL %s %s\n", name, detail);
+}
+
+#define CHECK(expr) check((expr), #expr)
+
+typedef std::vector<uint8_t> Bytes;
+
+// 取り出したパケットを溜める sink
+struct Collect {
+  std::vector<Bytes> frames;
+  std::vector<uint64_t> offsets;
+  std::vector<uint8_t> slot_lens;
+
+  void operator()(const Frame &frame) {
+    frames.push_back(Bytes(frame.data, frame.data + frame.len));
+    offsets.push_back(frame.offset);
+    slot_lens.push_back(frame.kind == FRAME_SENSORY ? sensory_slot_len(frame) : 0);
+  }
+};
+
+// ---------- テスト用のパケット ---------------------------------------------------------------- //
+
+// 計測基板パケット (スロット長 slot_len, スロットの中身は seed からの連番)
+Bytes sensory_frame(uint8_t slot_len, uint8_t seed) {
+  Bytes p(SENSORY_PKT_DATA + slot_len * SENSORY_SLOT_COUNT + 1);
+  p[0] = SENSORY_HEADER_0;
+  p[1] = SENSORY_HEADER_1;
+  p[SENSORY_PKT_LENGTH] = slot_len * SENSORY_SLOT_COUNT;
+  for (size_t i = SENSORY_PKT_DATA; i < p.size() - 1; i++) p[i] = (uint8_t)(seed + i);
+  p.back() = checksum(p.data(), (uint8_t)(p.size() - 1));
+  return p;
+}
+
+// 操舵基板 → ESP のパケット (データは seed からの連番)
+Bytes esp_frame(uint8_t command, uint8_t data_len, uint8_t seed) {
+  Bytes p(esp_packet_len(data_len));
+  uint8_t *data = esp_packet_begin(p.data(), 0x01, command);
+  for (uint8_t i = 0; i < data_len; i++) data[i] = (uint8_t)(seed + i * 7);
+  esp_packet_end(p.data(), data_len);
+  return p;
+}
+
+void append(Bytes &stream, const Bytes &bytes) {
+  stream.insert(stream.end(), bytes.begin(), bytes.end());
+}
+
+// stream を chunk バイトずつ feed() し、最後に finish() する
+Collect feed_chunks(const Bytes &stream, size_t chunk, ParserStats *stats = NULL) {
+  FrameParser parser;
+  Collect sink;
+  for (size_t i = 0; i < stream.size(); i += chunk) {
+    parser.feed(stream.data() + i, std::min(chunk, stream.size() - i), sink);
+  }
+  parser.finish(sink);
+  if (stats) *stats = parser.stats;
+  return sink;
+}
+
+// ---------- FrameParser ---------------------------------------------------------------------- //
+
+// どこで区切って渡しても、まとめて渡したときと同じパケットが同じ位置で取り出せる
+void test_chunk_boundaries() {
+  Bytes stream;
+  Bytes garbage = {0x00, 0x7C, 0x11, 0x8D};
+  append(stream, garbage);
+  Bytes a = sensory_frame(SENSORY_SLOT_LEN, 1);
+  Bytes b = esp_frame(DCM_HLT, HLT_DATA_LEN, 2);
+  Bytes c = esp_frame(DCM_PRP, 3, 3);
+  append(stream, a);
+  append(stream, b);
+  append(stream, c);
+  for (size_t chunk = 1; chunk <= stream.size(); chunk++) {
+    ParserStats stats;
+    Collect sink = feed_chunks(stream, chunk, &stats);
+    bool ok = sink.frames.size() == 3 && sink.frames[0] == a && sink.frames[1] == b && sink.frames[2] == c
+              && sink.offsets[0] == garbage.size() && sink.offsets[1] == garbage.size() + a.size()
+              && sink.offsets[2] == garbage.size() + a.size() + b.size()
+              && stats.bytes == stream.size() && stats.discarded == garbage.size() && stats.checksum_fail == 0;
+    char detail[32];
+    snprintf(detail, sizeof(detail), "chunk %zu", chunk);
+    check(ok, "test_chunk_boundaries", detail);
+  }
+}
+
+// ヘッダーに似たゴミ・チェックサムが合わないパケットの後でもヘッダーを探し直して読める
+void test_resync() {
+  Bytes a = esp_frame(DCM_LNK, LNK_DATA_LEN, 4);
+  Bytes bad = esp_frame(DCM_BUS, BUS_DATA_LEN, 5);
+  bad[ESP_PKT_DATA] ^= 0x01;
+  Bytes stream = {0x8D, 0x00, 0x7C, 0xC7, 0xFF}; // 長さが合わない計測基板パケットのヘッダー
+  append(stream, bad);
+  append(stream, a);
+  for (size_t chunk : {(size_t)1, (size_t)7, stream.size()}) {
+    ParserStats stats;
+    Collect sink = feed_chunks(stream, chunk, &stats);
+    CHECK(sink.frames.size() == 1 && sink.frames[0] == a);
+    CHECK(stats.checksum_fail == 1);
+    CHECK(stats.discarded == stream.size() - a.size());
+  }
+
+  // チェックサムが合わないパケットの中に正しいパケットがあれば取り出す
+  Bytes inner = esp_frame(DCM_PRP, 2, 6);
+  Bytes outer = esp_frame(DCM_DSP, (uint8_t)(inner.size() + 4), 7);
+  std::copy(inner.begin(), inner.end(), outer.begin() + ESP_PKT_DATA + 2);
+  outer.back() ^= 0x01;
+  Collect sink = feed_chunks(outer, 5);
+  CHECK(sink.frames.size() == 1 && sink.frames[0] == inner);
+}
+
+// 最後のパケットが途中で切れていれば、そこまでのパケットだけを取り出して残りは捨てる
+void test_truncated_tail() {
+  Bytes a = sensory_frame(SENSORY_SLOT_LEN, 8);
+  Bytes b = esp_frame(DCM_HLT, HLT_DATA_LEN, 9);
+  Bytes stream = a;
+  stream.insert(stream.end(), b.begin(), b.begin() + b.size() / 2);
+  for (size_t chunk : {(size_t)1, (size_t)16, stream.size()}) {
+    ParserStats stats;
+    Collect sink = feed_chunks(stream, chunk, &stats);
+    CHECK(sink.frames.size() == 1 && sink.frames[0] == a);
+    CHECK(stats.discarded == b.size() / 2);
+  }
+  FrameParser parser;
+  Collect sink;
+  parser.parse_all(stream.data(), stream.size(), sink);
+  CHECK(sink.frames.size() == 1 && parser.stats.discarded == b.size() / 2);
+}
+
+// 旧版(19 byte)と新版(23 byte)のスロットは LENGTH で見分ける
+void test_slot_versions() {
+  Bytes stream;
+  append(stream, sensory_frame(SENSORY_SLOT_ESTIMATE, 10));
+  append(stream, sensory_frame(SENSORY_SLOT_LEN, 11));
+  append(stream, sensory_frame(SENSORY_SLOT_ESTIMATE, 12));
+  Collect sink = feed_chunks(stream, 9);
+  CHECK(sink.frames.size() == 3);
+  if (sink.frames.size() != 3) return;
+  CHECK(sink.slot_lens[0] == SENSORY_SLOT_ESTIMATE && sink.slot_lens[1] == SENSORY_SLOT_LEN && sink.slot_lens[2] == SENSORY_SLOT_ESTIMATE);
+  Frame old_frame = {FRAME_SENSORY, sink.frames[0].data(), (uint8_t)sink.frames[0].size(), 0};
+  Frame new_frame = {FRAME_SENSORY, sink.frames[1].data(), (uint8_t)sink.frames[1].size(), 0};
+  CHECK(!sensory_has_estimate(old_frame) && sensory_has_estimate(new_frame));
+  CHECK(sensory_slot(old_frame, 1) == old_frame.data + SENSORY_PKT_DATA + SENSORY_SLOT_ESTIMATE);
+  CHECK(sensory_slot(new_frame, 1) == new_frame.data + SENSORY_PKT_DATA + SENSORY_SLOT_LEN);
+}
+
+// ---------- 表の出力 ------------------------------------------------------------------------- //
+
+// CSV を読み、見出しの後の各行の値を返す
+bool read_csv(const std::string &path, std::vector<std::string> &header, std::vector<std::vector<int64_t> > &rows) {
+  FILE *fp = fopen(path.c_str(), "r");
+  if (fp == NULL) return false;
+  char line[4096];
+  bool first = true;
+  while (fgets(line, sizeof(line), fp)) {
+    std::vector<int64_t> values;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, ",\n", &save); tok; tok = strtok_r(NULL, ",\n", &save)) {
+      if (first) header.push_back(tok);
+      else values.push_back(strtoll(tok, NULL, 10));
+    }
+    if (!first) rows.push_back(values);
+    first = false;
+  }
+  fclose(fp);
+  return true;
+}
+
+// 列ごとのバイナリ dir/列名.bin を columns.txt の型で読み、行ごとの値を返す
+bool read_columns(const std::string &dir, std::vector<std::string> &header, std::vector<std::vector<int64_t> > &rows) {
+  FILE *schema = fopen((dir + "/columns.txt").c_str(), "r");
+  if (schema == NULL) return false;
+  char name[64], type[16];
+  std::vector<std::vector<int64_t> > columns;
+  while (fscanf(schema, "%63s %15s", name, type) == 2) {
+    header.push_back(name);
+    FILE *fp = fopen((dir + "/" + name + ".bin").c_str(), "rb");
+    if (fp == NULL) {
+      fclose(schema);
+      return false;
+    }
+    std::vector<int64_t> values;
+    std::string t = type;
+    size_t size = t == "uint8" ? 1 : t == "uint32" ? 4 : t == "uint64" ? 8 : 2;
+    uint8_t b[8];
+    while (fread(b, 1, size, fp) == size) {
+      uint64_t u = 0;
+      for (size_t i = 0; i < size; i++) u |= (uint64_t)b[i] << (8 * i);
+      if (t == "int16") values.push_back((int16_t)u);
+      else values.push_back((int64_t)u);
+    }
+    fclose(fp);
+    columns.push_back(values);
+  }
+  fclose(schema);
+  size_t count = columns.empty() ? 0 : columns[0].size();
+  for (size_t r = 0; r < count; r++) {
+    std::vector<int64_t> row;
+    for (size_t c = 0; c < columns.size(); c++) row.push_back(r < columns[c].size() ? columns[c][r] : INT64_MIN);
+    rows.push_back(row);
+  }
+  return true;
+}
+
+int run_decode(const char *a, const char *b, const char *c, const char *d = NULL) {
+  char *argv[] = {(char *)"decode", (char *)a, (char *)b, (char *)c, (char *)d, NULL};
+  return decode_main(d ? 5 : 4, argv);
+}
+
+// 同じ記録を CSV と列ごとのバイナリで書き出し、すべての表で値が一致する
+void test_binary_roundtrip() {
+  char tmpl[] = "/tmp/decode_test.XXXXXX";
+  if (mkdtemp(tmpl) == NULL) {
+    check(false, "test_binary_roundtrip", "mkdtemp");
+    return;
+  }
+  std::string dir = tmpl;
+  Bytes log = {0x55};
+  Bytes old_slots = sensory_frame(SENSORY_SLOT_ESTIMATE, 0x80); // 負の値を含む
+  append(log, old_slots);
+  append(log, sensory_frame(SENSORY_SLOT_LEN, 0xF0));
+  append(log, esp_frame(DCM_HLT, HLT_DATA_LEN, 0xC0));
+  append(log, esp_frame(DCM_LNK, LNK_DATA_LEN, 0x21));
+  append(log, esp_frame(DCM_BUS, BUS_DATA_LEN, 0xFE));
+  std::string path = dir + "/log.bin";
+  FILE *fp = fopen(path.c_str(), "wb");
+  fwrite(log.data(), 1, log.size(), fp);
+  fclose(fp);
+
+  std::string csv_dir = dir + "/csv";
+  std::string bin_dir = dir + "/bin";
+  CHECK(run_decode("-o", csv_dir.c_str(), path.c_str()) == 0);
+  CHECK(run_decode("-b", "-o", bin_dir.c_str(), path.c_str()) == 0);
+
+  const char *tables[] = {"sensory", "esp", "health", "link", "bus"};
+  const size_t expected_rows[] = {2 * SENSORY_SLOT_COUNT, 3, 1, 1, 1};
+  for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+    std::vector<std::string> csv_header, bin_header;
+    std::vector<std::vector<int64_t> > csv_rows, bin_rows;
+    bool read = read_csv(csv_dir + "/" + tables[t] + ".csv", csv_header, csv_rows)
+                && read_columns(bin_dir + "/" + tables[t], bin_header, bin_rows);
+    check(read, "test_binary_roundtrip", tables[t]);
+    check(csv_rows.size() == expected_rows[t], "test_binary_roundtrip rows", tables[t]);
+    check(csv_header == bin_header && csv_rows == bin_rows, "test_binary_roundtrip values", tables[t]);
+  }
+
+  // 旧版のスロットは推定位置に現在位置、経過時間に SENSORY_AGE_NONE が入る
+  std::vector<std::string> header;
+  std::vector<std::vector<int64_t> > rows;
+  read_csv(csv_dir + "/sensory.csv", header, rows);
+  size_t position = std::find(header.begin(), header.end(), "position") - header.begin();
+  size_t estimate = std::find(header.begin(), header.end(), "estimate") - header.begin();
+  size_t age = std::find(header.begin(), header.end(), "age") - header.begin();
+  CHECK(!rows.empty() && estimate < header.size() && age < header.size());
+  if (!rows.empty() && estimate < header.size() && age < header.size()) {
+    CHECK(rows[0][estimate] == rows[0][position] && rows[0][age] == SENSORY_AGE_NONE);
+    CHECK(rows[0][position] == SensorySlotPosition::get(old_slots.data() + SENSORY_PKT_DATA));
+  }
+
+  std::string rm = "rm -rf " + dir;
+  CHECK(system(rm.c_str()) == 0);
+}
+
+int main() {
+  test_chunk_boundaries();
+  test_resync();
+  test_truncated_tail();
+  test_slot_versions();
+  test_binary_roundtrip();
+
+  printf("decode_test: %u checks, %u failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
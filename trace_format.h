@@ -0,0 +1,69 @@
+/*
+   シリアル通信記録(トレース)の形式
+   SERIAL_CAPTURE 定義時にファームウェアが出力し、tools/replay で読み込む
+   Arduino に依存しないので、地上局側のツールからもそのままインクルードできる
+
+   ファイル先頭: TRACE_MAGIC(4byte) + TRACE_VERSION(1byte) + EEPROM の長さ(2byte リトルエンディアン) + 記録開始時の EEPROM の内容
+   レコード    : タグ(1byte) + 前のレコードからの経過時間(us, LEB128 可変長) + データ(1〜32byte)
+     タグ bit7-6: 系統 (LINK_*)
+          bit5  : 方向 (TRACE_RX / TRACE_TX)
+          bit4-0: データのバイト数 - 1
+     受信データの時刻はファームウェアが受信バッファから取り出した時刻 (読み出しを待たずに、各処理の合間に取り出す)
+     LINK_ANALOG, TRACE_RX のデータ: ピン番号(1byte) + 読み取り値(2byte リトルエンディアン)
+     LINK_ANALOG, TRACE_EVENT のデータ: 種類(TRACE_EVENT_*, 1byte) + 系統(1byte) + バイト数(1byte)
+*/
+
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define TRACE_MAGIC   "WTRC"
+#define TRACE_VERSION 2
+#define TRACE_HEADER_LEN 7 // EEPROM の内容の前まで
+
+// 通信系統
+#define LINK_SERVO   0 // SERVO_SERIAL
+#define LINK_ESP     1 // ESP_SERIAL
+#define LINK_SENSORY 2 // SENSORY_SERIAL
+#define LINK_ANALOG  3 // 操縦桿のアナログ入力
+#define LINKS        3 // シリアルの系統数
+
+#define TRACE_RX 0
+#define TRACE_TX 1
+
+#define TRACE_EVENT TRACE_TX // LINK_ANALOG の TRACE_TX はイベント
+
+#define TRACE_MAX_RUN 32 // 1レコードのデータの最大バイト数
+#define TRACE_ANALOG_LEN 3
+#define TRACE_EVENT_LEN 3
+
+// イベントの種類
+#define TRACE_EVENT_RX_DROPPED 0 // 受信待ちがあふれて捨てたバイト (ファームウェアは読めず、記録にも無い)
+#define TRACE_EVENT_RX_FULL    1 // 取り出す前に HardwareSerial の受信バッファが満杯だった (バイト数不明の取りこぼしがあり得る)
+
+inline uint8_t trace_tag(uint8_t link, uint8_t dir, uint8_t len) {
+  return (uint8_t)((link << 6) | (dir << 5) | ((len - 1) & 0x1F));
+}
+
+inline uint8_t trace_tag_link(uint8_t tag) {
+  return tag >> 6;
+}
+
+inline uint8_t trace_tag_dir(uint8_t tag) {
+  return (tag >> 5) & 0x01;
+}
+
+inline uint8_t trace_tag_len(uint8_t tag) {
+  return (tag & 0x1F) + 1;
+}
+
+// buf が対応する版のトレースなら EEPROM の内容を含むヘッダーの長さ、そうでなければ 0
+inline size_t trace_header_len(const uint8_t *buf, size_t size) {
+  if (size < TRACE_HEADER_LEN || memcmp(buf, TRACE_MAGIC, 4) != 0 || buf[4] != TRACE_VERSION) return 0;
+  size_t len = TRACE_HEADER_LEN + (buf[5] | (buf[6] << 8));
+  return len <= size ? len : 0;
+}
+
+#endif